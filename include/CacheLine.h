@@ -0,0 +1,37 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   CacheLine.h
+ *
+ * Cache line size and padding helpers to avoid false sharing.
+ */
+
+#ifndef CACHELINE_H
+#define CACHELINE_H
+
+#include <cstddef>      /* For std::size_t */
+
+
+/*
+ * Minimum offset between two objects to avoid false sharing. It is a fixed value instead of
+ * std::hardware_destructive_interference_size which is C++17 and ABI unstable.
+ */
+#if defined __aarch64__ && defined __APPLE__ || defined __powerpc64__
+static constexpr std::size_t cache_line_size = 128;
+#else
+static constexpr std::size_t cache_line_size = 64;
+#endif
+
+/*
+ * Value placed in its own cache line
+ */
+template <typename T>
+struct alignas(cache_line_size) CachePadded {
+   T value {};
+};
+
+#endif   /* CACHELINE_H */
@@ -0,0 +1,233 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Coroutine.h
+ *
+ * C++20 coroutine task type for the ThreadPool, built with the THREADPOOL_COROUTINES
+ * cmake option only.
+ */
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#ifdef THREADPOOL_COROUTINES
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "ThreadPool.h"
+
+template <typename T>
+class CoTask;
+
+/*
+ * Event signalled by a task finished under sync_wait()
+ */
+class SyncEvent {
+private:
+   std::mutex mutex {};
+   std::condition_variable cv {};
+   bool done { false };
+
+public:
+   // notify under the lock, so the waiter cannot destroy the event before it returns
+   inline void set()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+      cv.notify_all();
+   }
+
+   inline void wait()
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this]{ return done; });
+   }
+};
+
+/*
+ * Promise part common to all result types. The task starts when awaited and its final
+ * suspend transfers control straight to the awaiting coroutine, so a chain of tasks
+ * completes on the worker which finished the last step without a trip through a queue.
+ */
+class CoPromiseBase {
+protected:
+   std::coroutine_handle<> continuation {};
+   SyncEvent * event { nullptr };
+   std::exception_ptr error {};
+
+   template <typename T>
+   friend class CoTask;
+
+   template <typename T>
+   friend T sync_wait(CoTask<T> task);
+
+   struct FinalAwaiter {
+      inline bool await_ready() const noexcept { return false; }
+
+      template <typename Promise>
+      inline std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+      {
+         CoPromiseBase & promise = handle.promise();
+
+         if (promise.event != nullptr) {
+            // sync_wait() can destroy the frame right after this
+            promise.event->set();
+            return std::noop_coroutine();
+         }
+         if (promise.continuation) {
+            return promise.continuation;
+         }
+         return std::noop_coroutine();
+      }
+
+      inline void await_resume() const noexcept {}
+   };
+
+public:
+   inline std::suspend_always initial_suspend() const noexcept { return {}; }
+   inline FinalAwaiter final_suspend() const noexcept { return {}; }
+   inline void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+class CoPromise : public CoPromiseBase {
+private:
+   std::optional<T> value {};
+
+public:
+   inline CoTask<T> get_return_object() noexcept;
+
+   template <typename U>
+   inline void return_value(U && v) { value.emplace(std::forward<U>(v)); }
+
+   inline T result()
+   {
+      if (error) {
+         std::rethrow_exception(error);
+      }
+      return std::move(*value);
+   }
+};
+
+template <>
+class CoPromise<void> : public CoPromiseBase {
+public:
+   inline CoTask<void> get_return_object() noexcept;
+
+   inline void return_void() const noexcept {}
+
+   inline void result()
+   {
+      if (error) {
+         std::rethrow_exception(error);
+      }
+   }
+};
+
+/*
+ * Lazily started coroutine returning T, the coroutine frame is its only allocation.
+ * Awaiting the task starts it and resumes the awaiting coroutine when it finishes.
+ * Use co_await pool.schedule() inside to continue on a worker of the pool.
+ */
+template <typename T = void>
+class CoTask {
+public:
+   using promise_type = CoPromise<T>;
+
+private:
+   std::coroutine_handle<promise_type> handle {};
+
+   template <typename U>
+   friend U sync_wait(CoTask<U> task);
+
+   struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      inline bool await_ready() const noexcept { return false; }
+
+      inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+      {
+         handle.promise().continuation = awaiting;
+         return handle;
+      }
+
+      inline T await_resume() { return handle.promise().result(); }
+   };
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   CoTask() noexcept {};
+   explicit CoTask(std::coroutine_handle<promise_type> h) noexcept : handle(h) {};
+   CoTask(const CoTask &) = delete;
+   CoTask(CoTask && other) noexcept : handle(std::exchange(other.handle, {})) {};
+   ~CoTask()
+   {
+      if (handle) {
+         handle.destroy();
+      }
+   };
+
+/*
+ * Standard assign operators
+ */
+   CoTask & operator=(const CoTask &) = delete;
+   CoTask & operator=(CoTask && other) noexcept
+   {
+      if (this != &other) {
+         if (handle) {
+            handle.destroy();
+         }
+         handle = std::exchange(other.handle, {});
+      }
+      return *this;
+   }
+
+/*
+ * Checks if the task refers to a coroutine
+ */
+   inline bool valid() const noexcept { return static_cast<bool>(handle); }
+
+   inline Awaiter operator co_await() && noexcept { return Awaiter { handle }; }
+   inline Awaiter operator co_await() & noexcept { return Awaiter { handle }; }
+};
+
+template <typename T>
+inline CoTask<T> CoPromise<T>::get_return_object() noexcept
+{
+   return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() noexcept
+{
+   return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+/*
+ * Starts the task on the calling thread, blocks until it finishes and returns its result
+ * or rethrows its exception. It must not be called from a job running in the pool.
+ */
+template <typename T>
+T sync_wait(CoTask<T> task)
+{
+   SyncEvent event;
+
+   task.handle.promise().event = &event;
+   task.handle.resume();
+   event.wait();
+   return task.handle.promise().result();
+}
+
+#endif   /* THREADPOOL_COROUTINES */
+
+#endif   /* COROUTINE_H */
@@ -0,0 +1,166 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   DeadlineQueue.h
+ *
+ * Concurrent earliest-deadline-first queue built of binary heaps sharded by producer.
+ */
+
+#ifndef DEADLINEQUEUE_H
+#define DEADLINEQUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "CacheLine.h"
+
+
+/*
+ * Every shard is a binary heap under its own lock, so producers pushing to different
+ * shards never contend. The earliest deadline of every shard is published in an atomic,
+ * consumers scan these without locking and lock the shard with the globally earliest
+ * deadline only. Entries with equal deadlines leave their shard in FIFO order.
+ */
+template <typename T>
+class DeadlineQueue {
+public:
+   using Clock = std::chrono::steady_clock;
+
+private:
+   static constexpr Clock::rep none = std::numeric_limits<Clock::rep>::max();
+
+   struct Entry {
+      Clock::time_point deadline;
+      std::uint64_t seq;
+      T value;
+   };
+
+   // heap order with the earliest deadline on top
+   struct Later {
+      inline bool operator()(const Entry & a, const Entry & b) const
+      {
+         return a.deadline > b.deadline || (a.deadline == b.deadline && a.seq > b.seq);
+      }
+   };
+
+   struct alignas(cache_line_size) Shard {
+      std::atomic<Clock::rep> earliest { none };
+      std::atomic_size_t count { 0 };
+      std::mutex mutex {};
+      std::vector<Entry> heap {};
+      std::uint64_t seq { 0 };
+
+      // called with the shard mutex held, the maximum time point is published below none
+      inline void publish()
+      {
+         earliest.store(heap.empty() ? none : std::min(heap.front().deadline.time_since_epoch().count(), none - 1),
+                        std::memory_order_release);
+         count.store(heap.size(), std::memory_order_release);
+      }
+   };
+
+   std::unique_ptr<Shard[]> shards;
+   std::size_t nshards;
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   explicit DeadlineQueue(std::size_t n = 1) : shards(new Shard[n > 0 ? n : 1]), nshards(n > 0 ? n : 1) {};
+   DeadlineQueue(DeadlineQueue& other) = delete;
+   ~DeadlineQueue() {};
+
+/*
+ * Checks if a queue is empty, does not lock
+ */
+   inline bool empty() const
+   {
+      for (std::size_t i = 0; i < nshards; i++) {
+         if (shards[i].count.load(std::memory_order_acquire) > 0) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+/*
+ * Return the size of the queue
+ */
+   inline std::size_t size() const
+   {
+      std::size_t n = 0;
+
+      for (std::size_t i = 0; i < nshards; i++) {
+         n += shards[i].count.load(std::memory_order_acquire);
+      }
+      return n;
+   }
+
+/*
+ * Add an object with its deadline to the shard selected by the hint, usually the
+ * producer id, so a single producer keeps FIFO order of equal deadlines
+ */
+   inline void push(std::size_t hint, Clock::time_point deadline, T t)
+   {
+      Shard & s = shards[hint % nshards];
+      std::lock_guard<std::mutex> l(s.mutex);
+
+      s.heap.push_back(Entry { deadline, s.seq++, std::move(t) });
+      std::push_heap(s.heap.begin(), s.heap.end(), Later());
+      s.publish();
+   }
+
+/*
+ * Remove and return the object with the earliest deadline, concurrent pushes and pops
+ * can make it the earliest of its shard only.
+ */
+   inline bool pop(T& t, Clock::time_point & deadline)
+   {
+      for (;;) {
+         Clock::rep best = none;
+         std::size_t victim = 0;
+
+         for (std::size_t i = 0; i < nshards; i++) {
+            Clock::rep e = shards[i].earliest.load(std::memory_order_acquire);
+            if (e < best) {
+               best = e;
+               victim = i;
+            }
+         }
+         if (best == none) {
+            return false;
+         }
+
+         Shard & s = shards[victim];
+         std::lock_guard<std::mutex> l(s.mutex);
+         if (s.heap.empty()) {
+            // lost the race with other consumer, scan again
+            continue;
+         }
+
+         std::pop_heap(s.heap.begin(), s.heap.end(), Later());
+         deadline = s.heap.back().deadline;
+         t = std::move(s.heap.back().value);
+         s.heap.pop_back();
+         s.publish();
+         return true;
+      }
+   }
+};
+
+template <typename T>
+constexpr typename DeadlineQueue<T>::Clock::rep DeadlineQueue<T>::none;
+
+#endif   /* DEADLINEQUEUE_H */
@@ -0,0 +1,180 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Fiber.h
+ *
+ * Stackful fibers running the jobs of a ThreadPool in the fiber mode, and blocking
+ * primitives which suspend the calling fiber instead of its worker thread.
+ */
+
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>      /* For std::size_t */
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Task.h"
+
+class ThreadPool;
+
+// Job running on its own stack, defined by the fiber scheduler
+struct Fiber;
+
+// Default stack size of a fiber, the memory is committed on first touch only
+constexpr std::size_t default_fiber_stack = 64 * 1024;
+
+/*
+ * User-space scheduler of a worker in the fiber mode. Every job runs on a fiber taken
+ * from a pool of stacks, a fiber which blocks switches back to the scheduler, so the
+ * worker goes on with other jobs. A woken fiber is queued in the pool and resumed by
+ * whichever worker gets it first, so code running on fibers must not cache addresses
+ * of thread_local variables across blocking calls.
+ */
+class FiberScheduler {
+private:
+   struct Context;
+
+   ThreadPool * pool;
+   std::size_t stack_size;
+   std::unique_ptr<Context> context;
+   std::vector<Fiber *> cache {};         // finished fibers ready for reuse
+   Fiber * current { nullptr };
+
+   // Take a free fiber from the cache, the pool or allocate a new one
+   Fiber * acquire();
+   // Return a finished fiber to the cache, or to the pool when the cache is full
+   void release(Fiber * fiber);
+   // Run the fiber until it finishes or blocks, returns true when it finished
+   bool switch_to(Fiber * fiber);
+   // Switch from the running fiber back to its scheduler
+   static void suspend(Fiber * fiber);
+   // Entry point of new fibers
+   static void entry();
+
+public:
+   FiberScheduler(ThreadPool * pool, std::size_t stack_size);
+   FiberScheduler(const FiberScheduler &) = delete;
+   ~FiberScheduler();
+
+   // Check if the platform supports fibers
+   static bool supported();
+
+   // Run the job on a fiber until it finishes or blocks, returns true when it finished
+   bool run(Task & task);
+
+   // Continue a woken fiber until it finishes or blocks again, returns true when it finished
+   inline bool resume(Fiber * fiber) { return switch_to(fiber); }
+
+   // Free the fiber and its stack, used by the pool destructor
+   static void destroy(Fiber * fiber);
+
+   // Return the fiber running on the calling thread, nullptr outside of fibers
+   static Fiber * running();
+
+   // Block the running fiber after it registered itself as a waiter under the lock, the
+   // lock is released and the fiber cannot be woken before it is fully switched out
+   static void park(std::unique_lock<std::mutex> & lock);
+
+   // Queue a parked fiber to be resumed by the pool
+   static void wake(Fiber * fiber);
+
+   // Suspend the running fiber for the time, using the pool timers
+   static void sleep(Fiber * fiber, std::chrono::steady_clock::duration time);
+
+   // Queue the running fiber behind other ready fibers and jobs
+   static void yield(Fiber * fiber);
+};
+
+/*
+ * Waiter of a blocking primitive, either a fiber or a thread outside of fibers
+ */
+struct FiberWaiter {
+   Fiber * fiber;
+   bool ready { false };
+   std::condition_variable cv {};
+
+   FiberWaiter() : fiber(FiberScheduler::running()) {};
+
+   // wait with the primitive lock held until notified
+   inline void wait(std::unique_lock<std::mutex> & lock)
+   {
+      if (fiber != nullptr) {
+         FiberScheduler::park(lock);
+      } else {
+         cv.wait(lock, [this]{ return ready; });
+      }
+   }
+
+   // called with the primitive lock held
+   inline void notify()
+   {
+      if (fiber != nullptr) {
+         FiberScheduler::wake(fiber);
+      } else {
+         ready = true;
+         cv.notify_one();
+      }
+   }
+};
+
+/*
+ * Mutex which suspends a blocked fiber instead of its thread, it can be used from
+ * threads outside of fibers too. Ownership passes directly to the first waiter.
+ */
+class FiberMutex {
+private:
+   std::mutex guard {};
+   bool locked { false };
+   std::deque<FiberWaiter *> waiters {};
+
+public:
+   FiberMutex() {};
+   FiberMutex(const FiberMutex &) = delete;
+
+   void lock();
+   bool try_lock();
+   void unlock();
+};
+
+/*
+ * Condition variable for FiberMutex which suspends a waiting fiber instead of its thread
+ */
+class FiberConditionVariable {
+private:
+   std::mutex guard {};
+   std::deque<FiberWaiter *> waiters {};
+
+public:
+   FiberConditionVariable() {};
+   FiberConditionVariable(const FiberConditionVariable &) = delete;
+
+   void wait(std::unique_lock<FiberMutex> & lock);
+
+   template <typename Predicate>
+   inline void wait(std::unique_lock<FiberMutex> & lock, Predicate pred)
+   {
+      while (!pred()) {
+         wait(lock);
+      }
+   }
+
+   void notify_one();
+   void notify_all();
+};
+
+// Suspend the calling fiber, or the thread outside of fibers, for the time
+void fiber_sleep_for(std::chrono::steady_clock::duration time);
+
+// Let other fibers of the pool run, or yield the thread outside of fibers
+void fiber_yield();
+
+#endif   /* FIBER_H */
@@ -0,0 +1,661 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Future.h
+ *
+ * Future returned by ThreadPool::submit. The future shared state and the submitted
+ * callable live in the same control block, so a submit requires a single allocation.
+ */
+
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <exception>
+#include <future>       /* For std::future_error and std::future_status */
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Task.h"
+
+class ThreadPool;
+
+/*
+ * Exception stored in the future of a task cancelled before it run
+ */
+class TaskCancelled : public std::runtime_error {
+public:
+   TaskCancelled() : std::runtime_error("task cancelled") {};
+};
+
+/*
+ * Runs continuations of the futures it returned, implemented by ThreadPool
+ */
+class Executor {
+public:
+   virtual ~Executor() {};
+   virtual void schedule(Task & task) = 0;
+};
+
+/*
+ * Callback attached to the shared state, run once by the thread completing the future
+ */
+class Continuation {
+public:
+   virtual ~Continuation() {};
+   virtual void run() = 0;
+};
+
+/*
+ * Result storage of the shared state
+ */
+template <typename R>
+class FutureValue {
+private:
+   typename std::aligned_storage<sizeof(R), alignof(R)>::type data;
+
+public:
+   template <typename F>
+   inline void set(F& f) { new (&data) R(f()); }
+   inline R get() { return std::move(*reinterpret_cast<R*>(&data)); }
+   inline void destroy() { reinterpret_cast<R*>(&data)->~R(); }
+};
+
+template <typename R>
+class FutureValue<R&> {
+private:
+   R * data {};
+
+public:
+   template <typename F>
+   inline void set(F& f) { data = &f(); }
+   inline R& get() { return *data; }
+   inline void destroy() {}
+};
+
+template <>
+class FutureValue<void> {
+public:
+   template <typename F>
+   inline void set(F& f) { f(); }
+   inline void get() {}
+   inline void destroy() {}
+};
+
+/*
+ * Reference counted shared state of the future without the result type
+ */
+class FutureStateBase {
+protected:
+   enum : int { Pending, Ready, Cancelled };
+
+   std::atomic_uint refs { 2 };        // the future and the task
+   std::atomic_int status { Pending };
+   std::exception_ptr error {};
+   std::mutex mutex {};
+   std::condition_variable waitcv {};
+   std::atomic<Continuation *> continuation { nullptr };
+
+   // marks the continuation slot of a completed future
+   static inline Continuation * fired() { return reinterpret_cast<Continuation *>(std::uintptr_t(1)); }
+
+   // publish the result, wake up all waiting threads and run the continuation
+   inline void set_ready(int s = Ready)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         status.store(s, std::memory_order_release);
+      }
+      waitcv.notify_all();
+
+      Continuation * c = continuation.exchange(fired(), std::memory_order_acq_rel);
+      if (c != nullptr) {
+         c->run();
+         delete c;
+      }
+   }
+
+public:
+   Executor * executor { nullptr };    // runs the continuations, inline when null
+
+   FutureStateBase() {};
+   FutureStateBase(const FutureStateBase &) = delete;
+   virtual ~FutureStateBase() {};
+
+   inline void retain(unsigned n = 1) { refs.fetch_add(n, std::memory_order_relaxed); }
+
+   inline void release()
+   {
+      if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         delete this;
+      }
+   }
+
+   inline bool is_ready() const { return status.load(std::memory_order_acquire) != Pending; }
+
+   inline bool is_cancelled() const { return status.load(std::memory_order_acquire) == Cancelled; }
+
+   // run the continuation when the future completes, or right away when it already has,
+   // a shared state takes a single continuation
+   inline void attach(Continuation * c)
+   {
+      Continuation * expected = nullptr;
+
+      if (!continuation.compare_exchange_strong(expected, c, std::memory_order_acq_rel)) {
+         if (expected != fired()) {
+            delete c;
+            throw std::future_error(std::future_errc::future_already_retrieved);
+         }
+         c->run();
+         delete c;
+      }
+   }
+
+   inline void set_exception(std::exception_ptr e)
+   {
+      error = e;
+      set_ready();
+   }
+
+   // complete the future without running its task
+   inline void cancel()
+   {
+      error = std::make_exception_ptr(TaskCancelled());
+      set_ready(Cancelled);
+   }
+
+   inline void wait()
+   {
+      if (!is_ready()) {
+         std::unique_lock<std::mutex> lock(mutex);
+         waitcv.wait(lock, [this]{ return is_ready(); });
+      }
+   }
+
+   template <typename Clock, typename Duration>
+   inline std::future_status wait_until(const std::chrono::time_point<Clock, Duration> & time)
+   {
+      if (!is_ready()) {
+         std::unique_lock<std::mutex> lock(mutex);
+         if (!waitcv.wait_until(lock, time, [this]{ return is_ready(); })) {
+            return std::future_status::timeout;
+         }
+      }
+      return std::future_status::ready;
+   }
+};
+
+/*
+ * Shared state with result of type R
+ */
+template <typename R>
+class FutureState : public FutureStateBase {
+private:
+   FutureValue<R> value {};
+
+public:
+   ~FutureState()
+   {
+      if (is_ready() && !error) {
+         value.destroy();
+      }
+   }
+
+   // execute the callable and store its result or exception
+   template <typename F>
+   inline void run(F&& f)
+   {
+      try {
+         value.set(f);
+      } catch (...) {
+         set_exception(std::current_exception());
+         return;
+      }
+      set_ready();
+   }
+
+   inline R get()
+   {
+      wait();
+      if (error) {
+         std::rethrow_exception(error);
+      }
+      return value.get();
+   }
+};
+
+/*
+ * Control block holding both the shared state and the callable
+ */
+template <typename R, typename F>
+class TaskState : public FutureState<R> {
+public:
+   F func;
+
+   template <typename Fn>
+   explicit TaskState(Fn&& f) : func(std::forward<Fn>(f)) {};
+};
+
+/*
+ * The callable stored in the job queue, small enough to fit into Task inline storage.
+ * Breaks the promise when destroyed without running, just like std::packaged_task.
+ */
+template <typename R, typename F>
+class TaskRunner {
+private:
+   TaskState<R, F> * state;
+
+public:
+   explicit TaskRunner(TaskState<R, F> * s) noexcept : state(s) {};
+   TaskRunner(const TaskRunner &) = delete;
+   TaskRunner(TaskRunner && other) noexcept : state(other.state) { other.state = nullptr; };
+   ~TaskRunner()
+   {
+      if (state != nullptr) {
+         if (!state->is_ready()) {
+            state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+         }
+         state->release();
+      }
+   };
+
+   inline void operator()() { state->run(state->func); }
+};
+
+/*
+ * Shared state of the aggregate future of a group of tasks, it gets ready when the last
+ * task finishes and holds the first exception thrown by any of them
+ */
+class BulkState : public FutureState<void> {
+private:
+   std::atomic_size_t remaining;
+   std::atomic_bool failed { false };
+   std::exception_ptr first_error {};
+
+public:
+   explicit BulkState(std::size_t n) : remaining(n) {};
+
+   inline void fail(std::exception_ptr e)
+   {
+      if (!failed.exchange(true, std::memory_order_acq_rel)) {
+         first_error = e;
+      }
+   }
+
+   inline void finish()
+   {
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         if (first_error) {
+            set_exception(first_error);
+         } else {
+            set_ready();
+         }
+         release();
+      }
+   }
+};
+
+/*
+ * The callable of a single task in a group with an aggregate future
+ */
+template <typename F>
+class BulkRunner {
+private:
+   BulkState * state;
+   F func;
+
+public:
+   template <typename Fn>
+   BulkRunner(BulkState * s, Fn&& f) : state(s), func(std::forward<Fn>(f)) {};
+   BulkRunner(const BulkRunner &) = delete;
+   BulkRunner(BulkRunner && other) noexcept(std::is_nothrow_move_constructible<F>::value)
+      : state(other.state), func(std::move(other.func)) { other.state = nullptr; };
+   ~BulkRunner()
+   {
+      if (state != nullptr) {
+         state->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+         state->finish();
+      }
+   };
+
+   inline void operator()()
+   {
+      try {
+         func();
+      } catch (...) {
+         state->fail(std::current_exception());
+      }
+      BulkState * s = state;
+      state = nullptr;
+      s->finish();
+   }
+};
+
+/*
+ * Provides access to the result of a task executed by the pool
+ */
+template <typename R>
+class Future {
+   friend class ThreadPool;
+   friend struct FutureAccess;
+
+private:
+   FutureState<R> * state { nullptr };
+
+   // releases the shared state when leaving get()
+   struct Release {
+      FutureState<R> * state;
+      ~Release() { state->release(); }
+   };
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   Future() noexcept {};
+   explicit Future(FutureState<R> * s) noexcept : state(s) {};
+   Future(const Future &) = delete;
+   Future(Future && other) noexcept : state(other.state) { other.state = nullptr; };
+   ~Future()
+   {
+      if (state != nullptr) {
+         state->release();
+      }
+   };
+
+/*
+ * Standard assign operators
+ */
+   Future & operator=(const Future &) = delete;
+   Future & operator=(Future && other) noexcept
+   {
+      if (this != &other) {
+         if (state != nullptr) {
+            state->release();
+         }
+         state = other.state;
+         other.state = nullptr;
+      }
+      return *this;
+   }
+
+/*
+ * Checks if the future refers to a shared state
+ */
+   inline bool valid() const noexcept { return state != nullptr; }
+
+/*
+ * Checks if the result is available
+ */
+   inline bool is_ready() const { return state->is_ready(); }
+
+/*
+ * Checks if the task was cancelled without running, get() throws TaskCancelled then
+ */
+   inline bool is_cancelled() const { return state->is_cancelled(); }
+
+/*
+ * Waits for the result and returns it, the future is not valid afterwards
+ */
+   inline R get()
+   {
+      Release guard { state };
+      state = nullptr;
+      return guard.state->get();
+   }
+
+/*
+ * Waits for the result to become available
+ */
+   inline void wait() const { state->wait(); }
+
+   template <typename Rep, typename Period>
+   inline std::future_status wait_for(const std::chrono::duration<Rep, Period> & time) const
+   {
+      return state->wait_until(std::chrono::steady_clock::now() + time);
+   }
+
+   template <typename Clock, typename Duration>
+   inline std::future_status wait_until(const std::chrono::time_point<Clock, Duration> & time) const
+   {
+      return state->wait_until(time);
+   }
+
+/*
+ * Schedules f(future) onto the pool when the result is available, without blocking any
+ * thread, and returns the future of its result. The future is not valid afterwards.
+ * The future keeps a plain pointer to its pool, so then() must not be called after the
+ * pool is destroyed.
+ */
+   template <typename F>
+   auto then(F&& f) -> Future<decltype(f(std::declval<Future<R>>()))>;
+};
+
+/*
+ * Creates a task executing the callable and the future for its result with a single allocation
+ */
+template <typename R, typename F>
+inline Task make_task(F&& f, Future<R> & future)
+{
+   auto state = new TaskState<R, typename std::decay<F>::type>(std::forward<F>(f));
+   future = Future<R>(state);
+   return Task(TaskRunner<R, typename std::decay<F>::type>(state));
+}
+
+/*
+ * Access to the shared state for the combinators
+ */
+struct FutureAccess {
+   template <typename R>
+   static inline FutureState<R> * state(Future<R> & future) { return future.state; }
+};
+
+/*
+ * Creates a task whose future's continuations run on the executor
+ */
+template <typename R, typename F>
+inline Task make_task(F&& f, Future<R> & future, Executor * executor)
+{
+   Task task = make_task(std::forward<F>(f), future);
+   FutureAccess::state(future)->executor = executor;
+   return task;
+}
+
+/*
+ * Hands the task of a continuation to the executor once the future completes
+ */
+class ScheduleContinuation : public Continuation {
+private:
+   Task task;
+   Executor * executor;
+
+public:
+   ScheduleContinuation(Task && t, Executor * e) : task(std::move(t)), executor(e) {};
+
+   void run() override
+   {
+      if (executor != nullptr) {
+         executor->schedule(task);
+      } else {
+         task();
+      }
+   }
+};
+
+/*
+ * The callable of a continuation, gets the completed future
+ */
+template <typename F, typename R>
+struct ThenCall {
+   F func;
+   Future<R> source;
+
+   inline auto operator()() -> decltype(func(std::move(source))) { return func(std::move(source)); }
+};
+
+template <typename R>
+template <typename F>
+auto Future<R>::then(F&& f) -> Future<decltype(f(std::declval<Future<R>>()))>
+{
+   using U = decltype(f(std::declval<Future<R>>()));
+
+   if (state == nullptr) {
+      throw std::future_error(std::future_errc::no_state);
+   }
+
+   FutureState<R> * s = state;
+   Executor * executor = s->executor;
+   Future<U> next;
+   // the task keeps the shared state alive until the continuation runs
+   Task task = make_task(ThenCall<typename std::decay<F>::type, R> { std::forward<F>(f), std::move(*this) }, next, executor);
+   s->attach(new ScheduleContinuation(std::move(task), executor));
+   return next;
+}
+
+/*
+ * Result of when_any(), the futures in their original order and the index of the ready one
+ */
+template <typename T>
+struct WhenAny {
+   std::size_t index;
+   std::vector<T> futures;
+};
+
+/*
+ * Shared state of when_all(), ready when the last of the futures completes
+ */
+template <typename T>
+class WhenAllState : public FutureState<std::vector<T>> {
+private:
+   std::vector<T> futures;
+   std::atomic_size_t remaining;
+
+   class Arrival : public Continuation {
+   private:
+      WhenAllState * state;
+
+   public:
+      explicit Arrival(WhenAllState * s) : state(s) {};
+      void run() override { state->arrive(); }
+   };
+
+public:
+   explicit WhenAllState(std::vector<T> && f) : futures(std::move(f)), remaining(futures.size() + 1) {};
+
+   inline void arrive()
+   {
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         this->run([this]{ return std::move(futures); });
+         this->release();
+      }
+   }
+
+   // attaches to every future, the extra arrival covers the futures completing meanwhile
+   inline void start()
+   {
+      for (auto & f : futures) {
+         FutureAccess::state(f)->attach(new Arrival(this));
+      }
+      arrive();
+   }
+};
+
+/*
+ * Shared state of when_any(), ready when the first of the futures completes
+ */
+template <typename T>
+class WhenAnyState : public FutureState<WhenAny<T>> {
+private:
+   std::vector<T> futures;
+   std::atomic_bool done { false };
+
+   class Arrival : public Continuation {
+   private:
+      WhenAnyState * state;
+      std::size_t index;
+
+   public:
+      Arrival(WhenAnyState * s, std::size_t i) : state(s), index(i) {};
+      void run() override { state->arrive(index); }
+   };
+
+public:
+   explicit WhenAnyState(std::vector<T> && f) : futures(std::move(f)) {};
+
+   inline void arrive(std::size_t index)
+   {
+      if (!done.exchange(true, std::memory_order_acq_rel)) {
+         this->run([this, index]{ return WhenAny<T> { index, std::move(futures) }; });
+      }
+      this->release();
+   }
+
+   // every attached future holds a reference until it completes
+   inline void start()
+   {
+      const std::size_t n = futures.size();
+
+      this->retain(n);
+      this->release();
+      for (std::size_t i = 0; i < n; i++) {
+         FutureAccess::state(futures[i])->attach(new Arrival(this, i));
+      }
+   }
+};
+
+/*
+ * Returns the future of all the futures of the range, ready when all of them are. The
+ * futures are moved from and their continuation slot is taken.
+ */
+template <typename It>
+auto when_all(It first, It last) -> Future<std::vector<typename std::iterator_traits<It>::value_type>>
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   std::vector<T> futures(std::make_move_iterator(first), std::make_move_iterator(last));
+   Executor * executor = futures.empty() ? nullptr : FutureAccess::state(futures.front())->executor;
+   auto state = new WhenAllState<T>(std::move(futures));
+   Future<std::vector<T>> future(state);
+
+   state->executor = executor;
+   state->start();
+   return future;
+}
+
+/*
+ * Returns the future ready when the first of the futures of the range is. The futures
+ * are moved from and their continuation slot is taken.
+ */
+template <typename It>
+auto when_any(It first, It last) -> Future<WhenAny<typename std::iterator_traits<It>::value_type>>
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   std::vector<T> futures(std::make_move_iterator(first), std::make_move_iterator(last));
+   if (futures.empty()) {
+      throw std::invalid_argument("when_any of no futures");
+   }
+
+   Executor * executor = FutureAccess::state(futures.front())->executor;
+   auto state = new WhenAnyState<T>(std::move(futures));
+   Future<WhenAny<T>> future(state);
+
+   state->executor = executor;
+   state->start();
+   return future;
+}
+
+#endif   /* FUTURE_H */
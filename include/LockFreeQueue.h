@@ -0,0 +1,232 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   LockFreeQueue.h
+ *
+ * Bounded multi-producer multi-consumer queue based on the design by Dmitry Vyukov:
+ *  http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "CacheLine.h"
+
+
+/*
+ * Lock free implementation of a bounded Queue using a ring buffer with a sequence number
+ * in every slot. The capacity is rounded up to the power of two. The ring buffer is
+ * allocated once with the allocator.
+ */
+template <typename T, typename Alloc = std::allocator<T>>
+class LockFreeQueue {
+private:
+   struct Cell {
+      std::atomic_size_t sequence;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+      inline T * data() { return reinterpret_cast<T*>(&storage); }
+   };
+
+   using CellAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Cell>;
+
+   // producer and consumer positions in separate cache lines
+   alignas(cache_line_size) CellAlloc alloc;
+   Cell * buffer;
+   std::size_t mask;
+   alignas(cache_line_size) std::atomic_size_t enqueue_pos { 0 };
+   alignas(cache_line_size) std::atomic_size_t dequeue_pos { 0 };
+   char padding[cache_line_size - sizeof(std::atomic_size_t)];
+
+   template <typename U>
+   inline bool push(U&& t)
+   {
+      Cell * cell;
+      std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+      for (;;) {
+         cell = &buffer[pos & mask];
+         std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+         std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+         if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+               break;
+            }
+         } else if (diff < 0) {
+            // the queue is full
+            return false;
+         } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+         }
+      }
+
+      new (cell->data()) T(std::forward<U>(t));
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+   }
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   explicit LockFreeQueue(std::size_t capacity = 65536, const Alloc & a = Alloc()) : alloc(a)
+   {
+      std::size_t c = 2;
+      while (c < capacity){
+         c <<= 1;
+      }
+      buffer = std::allocator_traits<CellAlloc>::allocate(alloc, c);
+      mask = c - 1;
+      for (std::size_t i = 0; i < c; i++) {
+         new (&buffer[i]) Cell;
+         buffer[i].sequence.store(i, std::memory_order_relaxed);
+      }
+   };
+   LockFreeQueue(LockFreeQueue& other) = delete;
+   ~LockFreeQueue()
+   {
+      T t;
+      while (dequeue(t)) {}
+      for (std::size_t i = 0; i <= mask; i++) {
+         buffer[i].~Cell();
+      }
+      std::allocator_traits<CellAlloc>::deallocate(alloc, buffer, mask + 1);
+   };
+
+/*
+ * Checks if a queue is empty
+ */
+   inline bool empty() const
+   {
+      return size() == 0;
+   }
+
+/*
+ * Return the (approximate) size of the queue
+ */
+   inline std::size_t size() const
+   {
+      std::size_t d = dequeue_pos.load(std::memory_order_relaxed);
+      std::size_t e = enqueue_pos.load(std::memory_order_relaxed);
+      return e > d ? e - d : 0;
+   }
+
+/*
+ * Return the maximum number of objects the queue can hold
+ */
+   inline std::size_t capacity() const
+   {
+      return mask + 1;
+   }
+
+/*
+ * Add an object to the queue if there is a free slot, the object is not touched otherwise
+ */
+   inline bool try_enqueue(T& t) { return push(t); }
+   inline bool try_enqueue(T&& t) { return push(std::move(t)); }
+
+/*
+ * Move up to n objects from the range to the queue with a single reservation of
+ * consecutive free slots, returns the number of objects moved
+ */
+   template <typename It>
+   inline std::size_t try_enqueue_bulk(It first, std::size_t n)
+   {
+      std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+      std::size_t k;
+
+      for (;;) {
+         // count free slots following the current position
+         for (k = 0; k < n && k <= mask; k++) {
+            std::size_t seq = buffer[(pos + k) & mask].sequence.load(std::memory_order_acquire);
+            if (seq != pos + k) {
+               break;
+            }
+         }
+         if (k == 0) {
+            std::size_t seq = buffer[pos & mask].sequence.load(std::memory_order_acquire);
+            if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos) < 0) {
+               // the queue is full
+               return 0;
+            }
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+            continue;
+         }
+         if (enqueue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+            break;
+         }
+      }
+
+      for (std::size_t i = 0; i < k; i++, ++first) {
+         Cell * cell = &buffer[(pos + i) & mask];
+         new (cell->data()) T(std::move(*first));
+         cell->sequence.store(pos + i + 1, std::memory_order_release);
+      }
+      return k;
+   }
+
+/*
+ * Add an object to the queue, waits for a free slot when the queue is full
+ */
+   inline void enqueue(T& t)
+   {
+      while (!push(t)) {
+         std::this_thread::yield();
+      }
+   }
+
+   inline void enqueue(T&& t)
+   {
+      while (!push(std::move(t))) {
+         std::this_thread::yield();
+      }
+   }
+
+/*
+ * Remove and return the object from the queue
+ */
+   inline bool dequeue(T& t)
+   {
+      Cell * cell;
+      std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+      for (;;) {
+         cell = &buffer[pos & mask];
+         std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+         std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+         if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+               break;
+            }
+         } else if (diff < 0) {
+            // the queue is empty
+            return false;
+         } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+         }
+      }
+
+      T * data = cell->data();
+      t = std::move(*data);
+      data->~T();
+      cell->sequence.store(pos + mask + 1, std::memory_order_release);
+      return true;
+   }
+};
+
+#endif   /* LOCKFREEQUEUE_H */
@@ -0,0 +1,96 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   NodeAllocator.h
+ *
+ * Allocator of NUMA node-local memory using the mbind syscall directly, so libnuma
+ * is not required.
+ */
+
+#ifndef NODEALLOCATOR_H
+#define NODEALLOCATOR_H
+
+#include <cstddef>      /* For std::size_t */
+#include <new>
+#if defined __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/*
+ * Allocates memory preferably from the NUMA node, falls back to the default heap when
+ * the node is negative or the platform has no NUMA support. Every allocation is mapped
+ * separately, so it should be used for large and long living buffers only.
+ */
+inline void * node_alloc(std::size_t size, int node)
+{
+#if defined __linux__ && defined SYS_mbind
+   if (node >= 0) {
+      void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr == MAP_FAILED) {
+         throw std::bad_alloc();
+      }
+
+      const int mpol_preferred = 1;          /* MPOL_PREFERRED from linux/mempolicy.h */
+      const std::size_t bits = sizeof(unsigned long) * 8;
+      unsigned long nodemask[1024 / (sizeof(unsigned long) * 8)] = {};
+      if (static_cast<std::size_t>(node) < sizeof(nodemask) * 8) {
+         nodemask[node / bits] = 1UL << (node % bits);
+         // failure just leaves the default policy, i.e. first touch
+         syscall(SYS_mbind, ptr, size, mpol_preferred, nodemask, sizeof(nodemask) * 8, 0);
+      }
+      return ptr;
+   }
+#endif
+
+   return ::operator new(size);
+}
+
+/*
+ * Releases memory allocated by node_alloc
+ */
+inline void node_free(void * ptr, std::size_t size, int node)
+{
+#if defined __linux__ && defined SYS_mbind
+   if (node >= 0) {
+      munmap(ptr, size);
+      return;
+   }
+#endif
+
+   (void)size;
+   ::operator delete(ptr);
+}
+
+/*
+ * Standard allocator interface over node_alloc
+ */
+template <typename T>
+class NodeAllocator {
+public:
+   using value_type = T;
+
+   int node { -1 };
+
+   NodeAllocator() noexcept {};
+   explicit NodeAllocator(int n) noexcept : node(n) {};
+   template <typename U>
+   NodeAllocator(const NodeAllocator<U> & other) noexcept : node(other.node) {};
+
+   inline T * allocate(std::size_t n) { return static_cast<T*>(node_alloc(n * sizeof(T), node)); }
+   inline void deallocate(T * p, std::size_t n) noexcept { node_free(p, n * sizeof(T), node); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const NodeAllocator<T> & a, const NodeAllocator<U> & b) { return a.node == b.node; }
+
+template <typename T, typename U>
+inline bool operator!=(const NodeAllocator<T> & a, const NodeAllocator<U> & b) { return a.node != b.node; }
+
+#endif   /* NODEALLOCATOR_H */
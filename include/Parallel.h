@@ -0,0 +1,761 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Parallel.h
+ *
+ * Parallel loop, reduction, sort, scan and partition algorithms running on the ThreadPool.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>      /* For std::size_t */
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "CacheLine.h"
+#include "ThreadPool.h"
+
+
+// Partitioning of the index range of a parallel loop, as the OpenMP schedule clause
+enum class Schedule {
+   Static,              // one equal chunk per participant, or chunks of the given grain
+   Dynamic,             // chunks of the given grain, 1 by default, taken on demand
+   Guided,              // chunks proportional to the remaining iterations, not below the grain
+   Auto,                // as Dynamic with the grain picked from the measured iteration cost
+};
+
+// Time a chunk of the Auto schedule should take
+constexpr std::chrono::microseconds parallel_chunk_time { 50 };
+
+/*
+ * Shared state of a parallel loop. Participants take chunks from a single atomic cursor,
+ * so the number of posted helpers does not depend on the number of chunks. The state is
+ * shared with the helpers, a helper starting after all chunks are taken just returns.
+ * The body is called as body(slot, from, to) for chunks of offsets into the range, the
+ * slot is unique among the participants, 0 for the calling thread.
+ */
+template <typename Body>
+class ParallelLoop {
+private:
+   std::size_t count;
+   Body & body;
+   Schedule schedule;
+   std::size_t grain;
+   std::size_t participants;
+   std::atomic_size_t cursor { 0 };
+   std::atomic_size_t active { 1 };       // the calling thread
+   std::atomic_size_t slots { 1 };
+   std::atomic_bool failed { false };
+   std::exception_ptr error {};
+   std::mutex mutex {};
+   std::condition_variable donecv {};
+
+   // claim the next chunk, returns false when the whole range is taken
+   inline bool claim(std::size_t & from, std::size_t & to)
+   {
+      if (schedule != Schedule::Guided) {
+         from = cursor.fetch_add(grain);
+         if (from >= count) {
+            return false;
+         }
+         to = std::min(count, from + grain);
+         return true;
+      }
+
+      from = cursor.load();
+      for (;;) {
+         if (from >= count) {
+            return false;
+         }
+         std::size_t size = std::max(grain, (count - from) / (2 * participants));
+         to = std::min(count, from + size);
+         if (cursor.compare_exchange_weak(from, to)) {
+            return true;
+         }
+      }
+   }
+
+public:
+   ParallelLoop(std::size_t n, Body & f, Schedule s, std::size_t g, std::size_t p)
+      : count(n), body(f), schedule(s), grain(g), participants(p) {};
+
+   // run the first iterations on the calling thread to measure their cost, and pick the
+   // grain so a chunk takes about parallel_chunk_time
+   void probe()
+   {
+      using Clock = std::chrono::steady_clock;
+      const std::size_t limit = std::max<std::size_t>(1, count / (8 * participants));
+      const auto start = Clock::now();
+      std::size_t done = 0;
+      Clock::duration spent {};
+
+      for (std::size_t k = 1; done < limit && spent < parallel_chunk_time / 10; k *= 2) {
+         const std::size_t end = std::min(limit, done + k);
+         body(0, done, end);
+         done = end;
+         spent = Clock::now() - start;
+      }
+
+      const auto per_item = std::max<Clock::rep>(1, spent.count() / static_cast<Clock::rep>(done));
+      grain = static_cast<std::size_t>(std::chrono::duration_cast<Clock::duration>(parallel_chunk_time).count() / per_item);
+      grain = std::max<std::size_t>(1, std::min(grain, (count - done) / (2 * participants)));
+      cursor.store(done, std::memory_order_relaxed);
+   }
+
+   // check if the remaining iterations make more than a single chunk
+   inline bool splittable() const { return count - cursor.load(std::memory_order_relaxed) > grain; }
+
+   // return the number of helpers worth posting
+   inline std::size_t helpers() const
+   {
+      const std::size_t left = count - cursor.load(std::memory_order_relaxed);
+      const std::size_t chunks = schedule == Schedule::Guided ? participants : (left + grain - 1) / grain;
+      return std::min(participants, chunks) - 1;
+   }
+
+   // a helper joins the loop and gets its slot, one joining after the range is taken finds
+   // no chunk, so the caller never waits for helpers still in the queue
+   inline std::size_t enter()
+   {
+      active.fetch_add(1);
+      return slots.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   // take and run chunks until the range is exhausted, then leave the loop
+   void work(std::size_t slot)
+   {
+      std::size_t from, to;
+
+      while (claim(from, to)) {
+         try {
+            body(slot, from, to);
+         } catch (...) {
+            if (!failed.exchange(true)) {
+               error = std::current_exception();
+            }
+            // stop everybody at the next claim
+            cursor.store(count);
+         }
+      }
+
+      if (active.fetch_sub(1) == 1) {
+         std::lock_guard<std::mutex> lock(mutex);
+         donecv.notify_all();
+      }
+   }
+
+   // wait for the helpers which took a chunk, then rethrow the first exception
+   void wait()
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         donecv.wait(lock, [this]{ return active.load() == 0; });
+      }
+      if (error) {
+         std::rethrow_exception(error);
+      }
+   }
+};
+
+// Return the number of threads taking part in a parallel algorithm run on the pool
+inline std::size_t parallel_participants(ThreadPool & pool) { return pool.size() + 1; }
+
+/*
+ * Runs body(slot, from, to) over the chunks of [0, count) on the pool and the calling
+ * thread, returns when all chunks have finished and rethrows the first exception.
+ */
+template <typename Body>
+void parallel_chunks(ThreadPool & pool, std::size_t count, Body & body, Schedule schedule, std::size_t grain)
+{
+   if (count == 0) {
+      return;
+   }
+
+   using Loop = ParallelLoop<Body>;
+   const std::size_t participants = parallel_participants(pool);
+
+   if (grain == 0) {
+      grain = schedule == Schedule::Static ? (count + participants - 1) / participants : 1;
+   }
+
+   auto loop = std::make_shared<Loop>(count, body, schedule, grain, participants);
+   if (schedule == Schedule::Auto) {
+      loop->probe();
+   }
+
+   if (loop->splittable()) {
+      auto helper = [loop]{ loop->work(loop->enter()); };
+      std::vector<decltype(helper)> tasks(loop->helpers(), helper);
+      pool.post_bulk(tasks.begin(), tasks.end());
+   }
+
+   loop->work(0);
+   loop->wait();
+}
+
+/*
+ * Calls body(i) for every i in [begin, end) on the pool. The calling thread takes part in
+ * the loop and returns when all iterations have finished, so it can be called from a job.
+ * The first exception thrown by the body stops the loop and is rethrown. The grain is the
+ * chunk size, 0 selects the default of the schedule.
+ */
+template <typename Index, typename Body>
+void parallel_for(ThreadPool & pool, Index begin, Index end, Body && body,
+                  Schedule schedule = Schedule::Static, std::size_t grain = 0)
+{
+   static_assert(std::is_integral<Index>::value, "parallel_for requires an integral index");
+
+   if (!(begin < end)) {
+      return;
+   }
+
+   auto chunk = [begin, &body](std::size_t, std::size_t from, std::size_t to){
+      for (std::size_t i = from; i < to; i++) {
+         body(begin + static_cast<Index>(i));
+      }
+   };
+   parallel_chunks(pool, static_cast<std::size_t>(end - begin), chunk, schedule, grain);
+}
+
+/*
+ * Reduces transform(x) of every element of [first, last) with op, starting from identity.
+ * Every participant accumulates its chunks into its own cache line padded partial result,
+ * the partials are combined pairwise in a tree at the end. As in std::reduce, op must be
+ * associative and commutative, since the chunks of a participant are not adjacent.
+ */
+template <typename It, typename T, typename Op, typename Transform>
+T parallel_transform_reduce(ThreadPool & pool, It first, It last, T identity, Op op, Transform transform,
+                            Schedule schedule = Schedule::Static, std::size_t grain = 0)
+{
+   const std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+   std::vector<CachePadded<T>> partial(parallel_participants(pool), CachePadded<T> { identity });
+
+   auto chunk = [&](std::size_t slot, std::size_t from, std::size_t to){
+      T acc = std::move(partial[slot].value);
+      for (It it = first + from, end = first + to; it != end; ++it) {
+         acc = op(std::move(acc), transform(*it));
+      }
+      partial[slot].value = std::move(acc);
+   };
+   parallel_chunks(pool, count, chunk, schedule, grain);
+
+   for (std::size_t stride = 1; stride < partial.size(); stride *= 2) {
+      for (std::size_t i = 0; i + stride < partial.size(); i += 2 * stride) {
+         partial[i].value = op(std::move(partial[i].value), std::move(partial[i + stride].value));
+      }
+   }
+   return std::move(partial[0].value);
+}
+
+/*
+ * Reduces the elements of [first, last) with op, starting from identity, see above.
+ */
+template <typename It, typename T, typename Op>
+T parallel_reduce(ThreadPool & pool, It first, It last, T identity, Op op,
+                  Schedule schedule = Schedule::Static, std::size_t grain = 0)
+{
+   using Ref = typename std::iterator_traits<It>::reference;
+
+   return parallel_transform_reduce(pool, first, last, std::move(identity), op,
+                                    [](Ref x) -> Ref { return x; }, schedule, grain);
+}
+
+/*
+ * Runs f on the calling thread and g on the pool in parallel and returns when both have
+ * finished, rethrowing the first exception. A g not started by a worker yet is taken back
+ * and run by the caller, so the caller only waits for a g which is actually running and
+ * nested calls cannot deadlock the pool.
+ */
+template <typename F, typename G>
+void parallel_invoke(ThreadPool & pool, F && f, G && g)
+{
+   enum : int { Queued, Taken, Done };
+   struct Fork {
+      std::atomic_int state { Queued };
+      std::exception_ptr error {};
+      std::mutex mutex {};
+      std::condition_variable donecv {};
+   };
+   auto fork = std::make_shared<Fork>();
+
+   pool.post([fork, &g]{
+      int expected = Queued;
+      if (!fork->state.compare_exchange_strong(expected, Taken)) {
+         return;
+      }
+      try {
+         g();
+      } catch (...) {
+         fork->error = std::current_exception();
+      }
+      {
+         std::lock_guard<std::mutex> lock(fork->mutex);
+         fork->state.store(Done);
+      }
+      fork->donecv.notify_all();
+   });
+
+   std::exception_ptr error {};
+   try {
+      f();
+   } catch (...) {
+      error = std::current_exception();
+   }
+
+   int expected = Queued;
+   if (fork->state.compare_exchange_strong(expected, Taken)) {
+      try {
+         g();
+      } catch (...) {
+         fork->error = std::current_exception();
+      }
+   } else {
+      std::unique_lock<std::mutex> lock(fork->mutex);
+      fork->donecv.wait(lock, [&fork]{ return fork->state.load() == Done; });
+   }
+
+   if (error) {
+      std::rethrow_exception(error);
+   }
+   if (fork->error) {
+      std::rethrow_exception(fork->error);
+   }
+}
+
+// Number of elements sorted or merged serially by the parallel sorts
+constexpr std::size_t parallel_sort_cutoff = 16384;
+
+// Smallest block of the block algorithms, radix sort, scans and partition
+constexpr std::size_t parallel_block_min = 16384;
+
+// Return the number of blocks of the range, a block per participant at most
+inline std::size_t parallel_blocks(ThreadPool & pool, std::size_t n)
+{
+   return std::max<std::size_t>(1, std::min(parallel_participants(pool), n / parallel_block_min));
+}
+
+/*
+ * Stable merge of two sorted ranges into out, the larger range is split in the middle and
+ * the other one at the matching bound, so both halves merge in parallel.
+ */
+template <typename It1, typename It2, typename Out, typename Compare>
+void parallel_merge(ThreadPool & pool, It1 first1, It1 last1, It2 first2, It2 last2, Out out,
+                    Compare comp, std::size_t cutoff)
+{
+   const std::size_t n1 = static_cast<std::size_t>(last1 - first1);
+   const std::size_t n2 = static_cast<std::size_t>(last2 - first2);
+
+   if (n1 + n2 <= cutoff) {
+      std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1),
+                 std::make_move_iterator(first2), std::make_move_iterator(last2), out, comp);
+      return;
+   }
+
+   It1 mid1;
+   It2 mid2;
+   if (n1 >= n2) {
+      // equal elements of the second range go after the split element of the first one
+      mid1 = first1 + n1 / 2;
+      mid2 = std::lower_bound(first2, last2, *mid1, comp);
+   } else {
+      // equal elements of the first range go before the split element of the second one
+      mid2 = first2 + n2 / 2;
+      mid1 = std::upper_bound(first1, last1, *mid2, comp);
+   }
+   Out mid = out + ((mid1 - first1) + (mid2 - first2));
+
+   parallel_invoke(pool,
+      [&]{ parallel_merge(pool, first1, mid1, first2, mid2, out, comp, cutoff); },
+      [&]{ parallel_merge(pool, mid1, last1, mid2, last2, mid, comp, cutoff); });
+}
+
+/*
+ * Recursive merge sort of [first, last), the result is left in place or, when to_buffer
+ * is set, in the buffer of the same size. The halves are sorted into the other array and
+ * merged back, so every level moves the elements once.
+ */
+template <typename It, typename Buf, typename Compare>
+void parallel_merge_sort(ThreadPool & pool, It first, It last, Buf buffer, bool to_buffer, Compare comp,
+                         bool stable, std::size_t cutoff)
+{
+   const std::size_t n = static_cast<std::size_t>(last - first);
+
+   if (n <= cutoff) {
+      if (stable) {
+         std::stable_sort(first, last, comp);
+      } else {
+         std::sort(first, last, comp);
+      }
+      if (to_buffer) {
+         std::move(first, last, buffer);
+      }
+      return;
+   }
+
+   It mid = first + n / 2;
+   Buf bmid = buffer + n / 2;
+   parallel_invoke(pool,
+      [&]{ parallel_merge_sort(pool, first, mid, buffer, !to_buffer, comp, stable, cutoff); },
+      [&]{ parallel_merge_sort(pool, mid, last, bmid, !to_buffer, comp, stable, cutoff); });
+
+   if (to_buffer) {
+      parallel_merge(pool, first, mid, mid, last, buffer, comp, cutoff);
+   } else {
+      parallel_merge(pool, buffer, bmid, bmid, buffer + n, first, comp, cutoff);
+   }
+}
+
+// the serial cutoff for the range, at least a few pieces for every participant
+inline std::size_t parallel_sort_grain(ThreadPool & pool, std::size_t n)
+{
+   return std::max(parallel_sort_cutoff, n / (8 * parallel_participants(pool)));
+}
+
+/*
+ * Sorts [first, last) of random access iterators with the comparator by the pool and the
+ * calling thread. Uses a buffer of the range size, so elements must be default
+ * constructible and move assignable.
+ */
+template <typename It, typename Compare>
+void parallel_sort(ThreadPool & pool, It first, It last, Compare comp)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+   const std::size_t n = static_cast<std::size_t>(last - first);
+   const std::size_t cutoff = parallel_sort_grain(pool, n);
+
+   if (n <= cutoff) {
+      std::sort(first, last, comp);
+      return;
+   }
+
+   std::vector<T> buffer(n);
+   parallel_merge_sort(pool, first, last, buffer.begin(), false, comp, false, cutoff);
+}
+
+/*
+ * As above, but equal elements keep their order
+ */
+template <typename It, typename Compare>
+void parallel_stable_sort(ThreadPool & pool, It first, It last, Compare comp)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+   const std::size_t n = static_cast<std::size_t>(last - first);
+   const std::size_t cutoff = parallel_sort_grain(pool, n);
+
+   if (n <= cutoff) {
+      std::stable_sort(first, last, comp);
+      return;
+   }
+
+   std::vector<T> buffer(n);
+   parallel_merge_sort(pool, first, last, buffer.begin(), false, comp, true, cutoff);
+}
+
+/*
+ * Stable LSD radix sort of [first, last) by the integral key(x), one byte per pass. The
+ * range is split into a block per participant, every block counts its digits into its own
+ * histogram, the offsets of the blocks are prefix sums over all histograms and the blocks
+ * scatter their elements in parallel. Passes where all keys have the same digit are
+ * skipped.
+ */
+template <typename It, typename Key>
+void parallel_radix_sort(ThreadPool & pool, It first, It last, Key key)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+   using K = typename std::decay<decltype(key(*first))>::type;
+   using U = typename std::make_unsigned<K>::type;
+   static_assert(std::is_integral<K>::value, "parallel_radix_sort requires an integral key");
+
+   const std::size_t n = static_cast<std::size_t>(last - first);
+   if (n < 2) {
+      return;
+   }
+
+   constexpr std::size_t radix = 256;
+   // signed keys have the sign bit flipped, so negative keys sort first
+   const U flip = std::is_signed<K>::value ? U(U(1) << (sizeof(U) * 8 - 1)) : U(0);
+   const std::size_t blocks = parallel_blocks(pool, n);
+   const std::size_t block = (n + blocks - 1) / blocks;
+   std::vector<std::array<std::size_t, radix>> offsets(blocks);
+   std::vector<T> buffer(n);
+   bool in_buffer = false;
+
+   for (unsigned shift = 0; shift < sizeof(U) * 8; shift += 8) {
+      auto digit = [&key, flip, shift](const T & x) {
+         return static_cast<std::size_t>((static_cast<U>(key(x)) ^ flip) >> shift) & (radix - 1);
+      };
+      auto pass = [&](auto src, auto dst){
+         parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+            auto & h = offsets[b];
+            h.fill(0);
+            for (auto it = src + b * block, end = src + std::min(n, (b + 1) * block); it != end; ++it) {
+               h[digit(*it)]++;
+            }
+         }, Schedule::Dynamic);
+
+         // a pass with all keys in one bucket leaves the order unchanged
+         for (std::size_t d = 0; d < radix; d++) {
+            std::size_t total = 0;
+            for (auto & h : offsets) {
+               total += h[d];
+            }
+            if (total == n) {
+               return false;
+            }
+            if (total > 0) {
+               break;
+            }
+         }
+
+         std::size_t sum = 0;
+         for (std::size_t d = 0; d < radix; d++) {
+            for (auto & h : offsets) {
+               const std::size_t c = h[d];
+               h[d] = sum;
+               sum += c;
+            }
+         }
+
+         parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+            auto & h = offsets[b];
+            for (auto it = src + b * block, end = src + std::min(n, (b + 1) * block); it != end; ++it) {
+               dst[h[digit(*it)]++] = std::move(*it);
+            }
+         }, Schedule::Dynamic);
+         return true;
+      };
+
+      if (in_buffer ? pass(buffer.begin(), first) : pass(first, buffer.begin())) {
+         in_buffer = !in_buffer;
+      }
+   }
+
+   if (in_buffer) {
+      parallel_for(pool, std::size_t(0), n, [&](std::size_t i){ first[i] = std::move(buffer[i]); },
+                   Schedule::Static);
+   }
+}
+
+// the key of the radix sort of integral elements
+struct RadixIdentity {
+   template <typename T>
+   inline T operator()(const T & x) const { return x; }
+};
+
+// integral elements but bool are sorted by the radix sort, others by the merge sort
+template <typename T>
+using RadixSortable = std::integral_constant<bool, std::is_integral<T>::value &&
+                                                   !std::is_same<typename std::remove_cv<T>::type, bool>::value>;
+
+template <typename It>
+void parallel_sort_dispatch(ThreadPool & pool, It first, It last, std::true_type)
+{
+   parallel_radix_sort(pool, first, last, RadixIdentity());
+}
+
+template <typename It>
+void parallel_sort_dispatch(ThreadPool & pool, It first, It last, std::false_type)
+{
+   parallel_sort(pool, first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+/*
+ * Sorts [first, last) in ascending order, integral elements take the radix sort path
+ */
+template <typename It>
+void parallel_sort(ThreadPool & pool, It first, It last)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   parallel_sort_dispatch(pool, first, last, RadixSortable<T>());
+}
+
+/*
+ * Stable sort in ascending order, integral elements take the radix sort path
+ */
+template <typename It>
+void parallel_stable_sort(ThreadPool & pool, It first, It last)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   if (RadixSortable<T>::value) {
+      parallel_sort(pool, first, last);
+   } else {
+      parallel_stable_sort(pool, first, last, std::less<T>());
+   }
+}
+
+/*
+ * Block scan: the first pass reduces every block in parallel, the block prefixes are
+ * scanned serially and the second pass scans every block from its prefix in parallel.
+ * Inner loops keep the running value in a local, so the compiler can keep it in a
+ * register and vectorize the reduction pass. Output may be the input range itself.
+ */
+template <typename It, typename Out, typename T, typename Op>
+Out parallel_scan(ThreadPool & pool, It first, It last, Out out, T init, Op op, bool inclusive)
+{
+   const std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+   const std::size_t blocks = parallel_blocks(pool, n);
+   const std::size_t block = blocks > 0 ? (n + blocks - 1) / blocks : 0;
+   std::vector<CachePadded<T>> prefix(blocks, CachePadded<T> { init });
+
+   if (n == 0) {
+      return out;
+   }
+
+   if (blocks > 1) {
+      parallel_for(pool, std::size_t(1), blocks, [&](std::size_t b){
+         // sum of block b - 1, its prefix is added below
+         It it = first + (b - 1) * block;
+         It end = first + b * block;
+         T sum = *it;
+         for (++it; it != end; ++it) {
+            sum = op(sum, *it);
+         }
+         prefix[b].value = std::move(sum);
+      }, Schedule::Dynamic);
+
+      // the inclusive scan has no init, so the first prefix is the first block sum alone
+      for (std::size_t b = inclusive ? 2 : 1; b < blocks; b++) {
+         prefix[b].value = op(prefix[b - 1].value, prefix[b].value);
+      }
+   }
+
+   parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+      It it = first + b * block;
+      It end = first + std::min(n, (b + 1) * block);
+      Out o = out + b * block;
+      T acc = prefix[b].value;
+
+      if (inclusive) {
+         if (b == 0) {
+            acc = *it;
+            *o = acc;
+            ++it;
+            ++o;
+         }
+         for (; it != end; ++it, ++o) {
+            acc = op(acc, *it);
+            *o = acc;
+         }
+      } else {
+         for (; it != end; ++it, ++o) {
+            T x = *it;
+            *o = acc;
+            acc = op(acc, x);
+         }
+      }
+   }, Schedule::Dynamic);
+
+   return out + n;
+}
+
+/*
+ * Writes the inclusive prefix sums of op over [first, last) to out, returns the end of
+ * the output. As in std::inclusive_scan, op must be associative.
+ */
+template <typename It, typename Out, typename Op>
+Out parallel_inclusive_scan(ThreadPool & pool, It first, It last, Out out, Op op)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   return parallel_scan(pool, first, last, out, T {}, op, true);
+}
+
+template <typename It, typename Out>
+Out parallel_inclusive_scan(ThreadPool & pool, It first, It last, Out out)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   return parallel_inclusive_scan(pool, first, last, out, std::plus<T>());
+}
+
+/*
+ * Writes the exclusive prefix sums of op over [first, last) starting from init to out,
+ * returns the end of the output
+ */
+template <typename It, typename Out, typename T, typename Op>
+Out parallel_exclusive_scan(ThreadPool & pool, It first, It last, Out out, T init, Op op)
+{
+   return parallel_scan(pool, first, last, out, std::move(init), op, false);
+}
+
+template <typename It, typename Out, typename T>
+Out parallel_exclusive_scan(ThreadPool & pool, It first, It last, Out out, T init)
+{
+   return parallel_exclusive_scan(pool, first, last, out, std::move(init), std::plus<T>());
+}
+
+/*
+ * Stable partition of [first, last), elements satisfying pred go first, returns the
+ * partition point. Every block counts its matches in parallel, the block offsets of both
+ * parts are prefix sums of the counts and the blocks scatter to a buffer in parallel.
+ * The predicate is called twice for every element and elements must be default
+ * constructible.
+ */
+template <typename It, typename Pred>
+It parallel_partition(ThreadPool & pool, It first, It last, Pred pred)
+{
+   using T = typename std::iterator_traits<It>::value_type;
+
+   const std::size_t n = static_cast<std::size_t>(last - first);
+   const std::size_t blocks = parallel_blocks(pool, n);
+   if (blocks < 2) {
+      return std::stable_partition(first, last, pred);
+   }
+
+   const std::size_t block = (n + blocks - 1) / blocks;
+   std::vector<CachePadded<std::size_t>> matched(blocks);
+
+   parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+      std::size_t count = 0;
+      for (It it = first + b * block, end = first + std::min(n, (b + 1) * block); it != end; ++it) {
+         count += pred(*it) ? 1 : 0;
+      }
+      matched[b].value = count;
+   }, Schedule::Dynamic);
+
+   std::size_t total = 0;
+   for (auto &m : matched) {
+      total += m.value;
+   }
+
+   std::vector<T> buffer(n);
+   parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+      std::size_t yes = 0;
+      for (std::size_t i = 0; i < b; i++) {
+         yes += matched[i].value;
+      }
+      std::size_t no = total + b * block - yes;
+      for (It it = first + b * block, end = first + std::min(n, (b + 1) * block); it != end; ++it) {
+         if (pred(*it)) {
+            buffer[yes++] = std::move(*it);
+         } else {
+            buffer[no++] = std::move(*it);
+         }
+      }
+   }, Schedule::Dynamic);
+
+   parallel_for(pool, std::size_t(0), blocks, [&](std::size_t b){
+      std::move(buffer.begin() + b * block, buffer.begin() + std::min(n, (b + 1) * block), first + b * block);
+   }, Schedule::Dynamic);
+
+   return first + total;
+}
+
+#endif   /* PARALLEL_H */
@@ -38,18 +38,20 @@
 #ifndef SAFEQUEUE_H
 #define SAFEQUEUE_H
 
+#include <atomic>
+#include <deque>
 #include <mutex>
-#include <queue>
 
 
 /*
- * Thread safe implementation of a Queue using a std::queue
+ * Thread safe implementation of a Queue using a std::deque
  */
 template <typename T>
 class SafeQueue {
 private:
-   std::queue<T> queue;
+   std::deque<T> queue;
    std::mutex mutex;
+   std::atomic_size_t count { 0 };
 
 public:
 /*
@@ -60,11 +62,10 @@ public:
    ~SafeQueue() {};
 
 /*
- * Checks if a queue is empty
+ * Checks if a queue is empty, does not lock so it is cheap to poll
  */
    inline bool empty() {
-      std::lock_guard<std::mutex> l(mutex);
-      return queue.empty();
+      return count.load(std::memory_order_acquire) == 0;
    }
 
 /*
@@ -72,8 +73,7 @@ public:
  */
    inline std::size_t size()
    {
-      std::lock_guard<std::mutex> l(mutex);
-      return queue.size();
+      return count.load(std::memory_order_acquire);
    }
 
 /*
@@ -82,7 +82,28 @@ public:
    inline void enqueue(T& t)
    {
       std::lock_guard<std::mutex> l(mutex);
-      queue.push(t);
+      queue.push_back(t);
+      count.fetch_add(1, std::memory_order_release);
+   }
+
+   inline void enqueue(T&& t)
+   {
+      std::lock_guard<std::mutex> l(mutex);
+      queue.push_back(std::move(t));
+      count.fetch_add(1, std::memory_order_release);
+   }
+
+/*
+ * Move all objects of the range to the queue with a single lock
+ */
+   template <typename It>
+   inline void enqueue(It first, It last)
+   {
+      std::lock_guard<std::mutex> l(mutex);
+      for (; first != last; ++first) {
+         queue.push_back(std::move(*first));
+      }
+      count.store(queue.size(), std::memory_order_release);
    }
 
 /*
@@ -90,6 +111,11 @@ public:
  */
    inline bool dequeue(T& t)
    {
+      // do not lock the empty queue
+      if (empty()) {
+         return false;
+      }
+
       std::lock_guard<std::mutex> l(mutex);
 
       if (queue.empty()) {
@@ -98,7 +124,30 @@ public:
 
       t = std::move(queue.front());
 
-      queue.pop();
+      queue.pop_front();
+      count.fetch_sub(1, std::memory_order_release);
+      return true;
+   }
+
+/*
+ * Remove and return the most recently added object
+ */
+   inline bool dequeue_last(T& t)
+   {
+      if (empty()) {
+         return false;
+      }
+
+      std::lock_guard<std::mutex> l(mutex);
+
+      if (queue.empty()) {
+         return false;
+      }
+
+      t = std::move(queue.back());
+
+      queue.pop_back();
+      count.fetch_sub(1, std::memory_order_release);
       return true;
    }
 };
@@ -0,0 +1,163 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Task.h
+ *
+ * Move-only type erased void() callable which stores small closures inline.
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>      /* For std::size_t */
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+/*
+ * A replacement of std::function<void()> for the job queues. Closures up to inline_size
+ * bytes which can be moved without throwing are stored in the object itself, so no heap
+ * allocation is required. Larger closures are allocated on the heap.
+ */
+class Task {
+public:
+   static constexpr std::size_t inline_size = 64;
+
+private:
+   // type dependent operations on the stored closure
+   struct Ops {
+      void (*invoke)(void * storage);
+      void (*move)(void * dst, void * src);
+      void (*destroy)(void * storage);
+   };
+
+   template <typename F>
+   struct InlineOps {
+      static void invoke(void * storage) { (*static_cast<F*>(storage))(); }
+      static void move(void * dst, void * src)
+      {
+         new (dst) F(std::move(*static_cast<F*>(src)));
+         static_cast<F*>(src)->~F();
+      }
+      static void destroy(void * storage) { static_cast<F*>(storage)->~F(); }
+      static constexpr Ops ops { invoke, move, destroy };
+   };
+
+   template <typename F>
+   struct HeapOps {
+      static void invoke(void * storage) { (**static_cast<F**>(storage))(); }
+      static void move(void * dst, void * src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+      static void destroy(void * storage) { delete *static_cast<F**>(storage); }
+      static constexpr Ops ops { invoke, move, destroy };
+   };
+
+   template <typename F>
+   using fits_inline = std::integral_constant<bool,
+      sizeof(F) <= inline_size &&
+      alignof(std::max_align_t) % alignof(F) == 0 &&
+      std::is_nothrow_move_constructible<F>::value>;
+
+   alignas(std::max_align_t) unsigned char storage[inline_size];
+   const Ops * ops { nullptr };
+
+   template <typename F>
+   inline void init(F&& f, std::true_type)
+   {
+      using Fn = typename std::decay<F>::type;
+      new (storage) Fn(std::forward<F>(f));
+      ops = &InlineOps<Fn>::ops;
+   }
+
+   template <typename F>
+   inline void init(F&& f, std::false_type)
+   {
+      using Fn = typename std::decay<F>::type;
+      *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+      ops = &HeapOps<Fn>::ops;
+   }
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   Task() noexcept {};
+   Task(std::nullptr_t) noexcept {};
+
+   template <typename F, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<F>::type, Task>::value &&
+      !std::is_same<typename std::decay<F>::type, std::nullptr_t>::value>::type>
+   Task(F&& f)
+   {
+      init(std::forward<F>(f), fits_inline<typename std::decay<F>::type>());
+   };
+
+   Task(const Task& other) = delete;
+
+   Task(Task&& other) noexcept : ops(other.ops)
+   {
+      if (ops != nullptr) {
+         ops->move(storage, other.storage);
+         other.ops = nullptr;
+      }
+   };
+
+   ~Task() { reset(); };
+
+/*
+ * Standard assign operators
+ */
+   Task & operator=(const Task& other) = delete;
+
+   Task & operator=(Task&& other) noexcept
+   {
+      if (this != &other) {
+         reset();
+         if (other.ops != nullptr) {
+            other.ops->move(storage, other.storage);
+            ops = other.ops;
+            other.ops = nullptr;
+         }
+      }
+      return *this;
+   }
+
+   Task & operator=(std::nullptr_t) noexcept
+   {
+      reset();
+      return *this;
+   }
+
+/*
+ * Checks if a task holds a callable
+ */
+   explicit operator bool() const noexcept { return ops != nullptr; }
+
+/*
+ * Execute the stored callable
+ */
+   inline void operator()() { ops->invoke(storage); }
+
+/*
+ * Release the stored callable
+ */
+   inline void reset() noexcept
+   {
+      if (ops != nullptr) {
+         ops->destroy(storage);
+         ops = nullptr;
+      }
+   }
+};
+
+template <typename F>
+constexpr Task::Ops Task::InlineOps<F>::ops;
+
+template <typename F>
+constexpr Task::Ops Task::HeapOps<F>::ops;
+
+#endif   /* TASK_H */
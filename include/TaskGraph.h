@@ -0,0 +1,119 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   TaskGraph.h
+ *
+ * Directed acyclic graph of jobs executed by the ThreadPool in dependency order.
+ */
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>      /* For std::size_t */
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Future.h"
+#include "ThreadPool.h"
+
+
+/*
+ * Every node counts its unfinished predecessors, the worker finishing the last of them
+ * runs the node right away and posts other ready successors from the same thread, so
+ * they go to its own deque in the WorkStealing mode. The graph keeps its counters and
+ * timings between runs, so running it again does not reallocate. A graph runs once at
+ * a time and must not be changed while running.
+ */
+class TaskGraph {
+public:
+   using Clock = std::chrono::steady_clock;
+   using Node = std::size_t;
+
+private:
+   struct Vertex {
+      std::function<void()> func;
+      std::vector<Node> successors {};
+      std::size_t predecessors { 0 };
+      Clock::duration start {};           // since the start of the run
+      Clock::duration finish {};
+   };
+
+   // the callable posted for a ready node, a posted copy dropped without running, by
+   // shutdown for example, abandons the node, so the future of the run still gets ready
+   struct Start {
+      TaskGraph * graph;
+      Node node;
+      bool posted;
+
+      Start(TaskGraph * g, Node n, bool p = true) : graph(g), node(n), posted(p) {};
+      Start(const Start & other) : graph(other.graph), node(other.node), posted(true) {};
+      Start(Start && other) noexcept : graph(other.graph), node(other.node), posted(other.posted) {
+         other.posted = false;
+      }
+      ~Start() {
+         if (posted) {
+            graph->abandon(node);
+         }
+      }
+      inline void operator()() {
+         posted = false;
+         graph->execute(node);
+      }
+   };
+
+   std::vector<Vertex> nodes {};
+   std::unique_ptr<std::atomic_size_t[]> pending {};
+   std::size_t pending_size { 0 };
+   std::vector<Node> order {};            // topological order, empty when not computed
+   std::vector<Start> roots {};
+   ThreadPool * pool { nullptr };
+   BulkState * state { nullptr };
+   std::atomic_bool failed { false };
+   Clock::time_point origin {};
+
+   // Compute the topological order and the roots after a change of the graph
+   void prepare();
+   // Run the node and the chain of its successors which got ready
+   void execute(Node node);
+   // Skip the node and every successor it leaves without a chance to run
+   void abandon(Node node);
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   TaskGraph() {};
+   TaskGraph(const TaskGraph &) = delete;
+   ~TaskGraph() {};
+
+   // Add a node running the function, returns its id
+   Node add(std::function<void()> func);
+
+   // Add a dependency, so the node to runs after the node from has finished
+   void add_edge(Node from, Node to);
+
+   // Run the graph on the pool, the future gets ready when all nodes have finished and
+   // holds the first exception thrown, nodes not started before a failure are skipped
+   Future<void> run(ThreadPool & pool);
+
+   // Return the number of nodes
+   inline std::size_t size() const { return nodes.size(); }
+
+   // Return the time the node started at since the start of the last run
+   inline Clock::duration start_time(Node node) const { return nodes[node].start; }
+
+   // Return the time the node run for in the last run
+   inline Clock::duration elapsed(Node node) const { return nodes[node].finish - nodes[node].start; }
+
+   // Return the longest sum of node times on a dependency path in the last run
+   Clock::duration critical_path();
+};
+
+#endif   /* TASKGRAPH_H */
@@ -38,45 +38,291 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#ifdef THREADPOOL_COROUTINES
+#include <coroutine>
+#endif
 #include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <iterator>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#include "CacheLine.h"
+#include "DeadlineQueue.h"
+#include "Fiber.h"
+#include "Future.h"
+#include "LockFreeQueue.h"
+#include "NodeAllocator.h"
 #include "SafeQueue.h"
+#include "Task.h"
+#include "TimerWheel.h"
+#include "Topology.h"
+#include "WorkStealingDeque.h"
+
+class ThreadPool : public Executor {
+   friend class FiberScheduler;
+
+public:
+   // Job scheduling mode selected at construction
+   enum class Scheduling {
+      Global,              // single shared job queue
+      WorkStealing,        // per worker deques with random victim stealing
+      LockFree,            // single shared lock-free bounded ring queue, nested submits to worker deques
+      Numa,                // job queue per NUMA node, workers bound to their node, nested submits to worker deques
+      Deadline,            // earliest deadline first from sharded heaps
+   };
+
+   // Worker to CPU binding selected at init
+   enum class Affinity {
+      None,                // no binding
+      Naive,               // worker i bound to CPU i modulo number of CPUs
+      Spread,              // distinct physical cores first, spread across NUMA nodes
+      Pack,                // distinct physical cores first, fill one NUMA node at a time
+   };
+
+   // Behaviour of a worker which has no job to run
+   enum class WaitPolicy {
+      Park,                // park on the condition variable immediately
+      Spin,                // spin a fixed number of times, then yield, then park
+      Adaptive,            // as Spin with the spin count adapted to the recent hit rate
+   };
+
+   // Priority level of a job, jobs submitted without a priority are Normal
+   enum class Priority {
+      High,                // served before all other jobs
+      Normal,              // served before Low jobs
+      Low,                 // served when no other job waits
+   };
+
+   // Default number of jobs a worker takes from higher levels before it serves a waiting lower level
+   static constexpr std::size_t default_aging = 16;
+
+   // Id of a delayed or periodic job, used to cancel it
+   using TimerId = TimerWheel::Id;
+
+   // Default number of spins before a worker yields and parks
+   static constexpr std::size_t default_spins = 1024;
+
+   // Capacity of the lock-free ring queue, jobs overflow into the global queue when full
+   static constexpr std::size_t ring_capacity = 65536;
+
+   // Default number of queued jobs which makes an elastic pool grow immediately
+   static constexpr std::size_t default_grow_depth = 64;
+
+   // Default number of extra workers started for workers blocked in blocking sections
+   static constexpr std::size_t default_spare_threads = 32;
+
+   // Maximum nesting of jobs a worker runs while waiting for futures, deeper waits block
+   static constexpr std::size_t max_help_depth = 32;
 
-class ThreadPool {
 private:
-   std::atomic_bool shut_flag { false };
-   SafeQueue<std::function<void()>> job_queue {};
+   // Job queue of a NUMA node, only its ring buffer is allocated from the node memory, the
+   // overflow queue, job closures stored outside of Task and future states use the global heap
+   struct NodeQueue {
+      LockFreeQueue<Task, NodeAllocator<Task>> ring;
+      SafeQueue<Task> overflow {};
+      std::vector<int> cpus;
+
+      NodeQueue(int node, std::vector<int> c)
+         : ring(ring_capacity, NodeAllocator<Task>(node)), cpus(std::move(c)) {};
+   };
+
+   // Job with a deadline and the future state to cancel when it is dropped
+   struct DeadlineJob {
+      Task task {};
+      FutureStateBase * state {};
+   };
+
+   class ThreadWorker;
+
+   // Per worker state, every worker writes to its own cache line only
+   struct alignas(cache_line_size) WorkerState {
+      ThreadWorker * worker { nullptr };      // the running worker, used to help while waiting
+      std::vector<std::unique_ptr<Task>> free_tasks {};   // deque wrappers for reuse, owner only
+      std::atomic_bool available { false };
+      std::atomic_bool running { false };
+      std::atomic_bool active { false };      // slot has a started worker thread
+      std::atomic_size_t met { 0 };           // deadline jobs finished in time
+      std::atomic_size_t missed { 0 };        // deadline jobs finished late or dropped
+      std::atomic_size_t dropped { 0 };       // deadline jobs dropped after their deadline
+   };
+
+   // read-mostly configuration and queue pointers
+   Scheduling scheduling { Scheduling::Global };
+   std::unique_ptr<LockFreeQueue<Task>> ring_queue {};
+   std::unique_ptr<DeadlineQueue<DeadlineJob>> deadline_queue {};
    std::vector<std::thread> threads {};
-   std::mutex mutex {};
+   std::vector<int> cpu_map {};
+   std::unique_ptr<WorkerState[]> worker_state {};
+   std::vector<std::unique_ptr<WorkStealingDeque<Task*>>> worker_queues {};
+   std::atomic_size_t used_slots { 0 };         // slots which ever started a worker, bound of steals and scans
+   std::vector<std::unique_ptr<NodeQueue>> node_queues {};
+   std::vector<int> cpu_node {};
+   std::function<void(std::exception_ptr)> exception_handler {};
+   WaitPolicy wait_policy { WaitPolicy::Park };
+   std::size_t spin_count { default_spins };
+   Affinity affinity { Affinity::None };
+   std::size_t min_threads {};
+   std::size_t max_threads {};
+   std::chrono::milliseconds keep_alive { 60000 };
+   std::size_t grow_depth { default_grow_depth };
+   std::chrono::milliseconds grow_wait { 10 };
+   std::atomic_bool prioritized { false };      // set by the first High or Low job
+   std::size_t aging { default_aging };
+   bool drop_expired { false };
+   std::size_t spare_threads { default_spare_threads };
+
+   // shared state written at runtime, every part in separate cache lines
+   alignas(cache_line_size) SafeQueue<Task> job_queue {};
+   alignas(cache_line_size) SafeQueue<Task> high_queue {};
+   alignas(cache_line_size) SafeQueue<Task> low_queue {};
+   alignas(cache_line_size) std::atomic_bool shut_flag { false };
+   alignas(cache_line_size) std::atomic_size_t sleeping_threads { 0 };
+   alignas(cache_line_size) std::atomic_size_t live_threads { 0 };
+   std::atomic_size_t target_threads { 0 };
+   std::atomic_size_t compensating { 0 };       // extra workers of blocking sections
+   alignas(cache_line_size) std::atomic_size_t outstanding { 0 };
+   std::atomic_size_t idle_waiters { 0 };
+   alignas(cache_line_size) std::mutex mutex {};
    std::condition_variable waitcv {};
-   std::atomic_size_t available_threads { 0 };
-   std::atomic_size_t running_threads { 0 };
+   std::condition_variable idlecv {};
+   // worker slots management, never taken on the job path
+   std::mutex resize_mutex {};
+   std::condition_variable supervisorcv {};
+   std::thread supervisor {};
+   bool started { false };
+   // timers, the wheel and its thread are created by the first timer
+   std::mutex timer_mutex {};
+   std::condition_variable timercv {};
+   std::unique_ptr<TimerWheel> timer_wheel {};
+   std::thread timer_thread {};
+   std::chrono::steady_clock::time_point timer_wake {};
+   bool timer_stop { false };
+   // fiber mode, fibers are shared by the workers as they migrate when resumed
+   std::size_t fiber_stack { 0 };         // 0 when the fiber mode is off
+   alignas(cache_line_size) SafeQueue<Fiber *> ready_fibers {};
+   std::mutex fiber_mutex {};
+   std::vector<Fiber *> fiber_free {};
+   std::vector<Fiber *> fiber_all {};
 
    class ThreadWorker {
    private:
       ThreadPool * ptr {};
+      std::size_t index {};
+      std::uint64_t seed {};
+      std::size_t spin_limit {};
+      std::size_t normal_passed {};       // jobs taken from higher levels while Normal ones waited
+      std::size_t low_passed {};          // jobs taken from higher levels while Low ones waited
+      std::chrono::steady_clock::time_point deadline {};
+      bool timed { false };               // the current job has a deadline
+      std::size_t helping { 0 };          // nesting of jobs run while waiting for futures
+
+      bool next_job(Task & task);
+      bool next_normal(Task & task);
+      bool next_prioritized(Task & task);
+      bool next_deadline(Task & task);
+      bool next_help(Task & task);
+      bool steal_job(Task * & job);
+      void idle();
+      void account(WorkerState & state);
 
    public:
-      ThreadWorker(ThreadPool * pool);
+      ThreadWorker(ThreadPool * pool, std::size_t idx);
       void operator()();
+      // Run queued jobs until the state is ready
+      void help(FutureStateBase & state);
    };
 
+   // Move the job into a wrapper for the deque of the calling worker, reusing its free wrappers
+   Task * wrap(Task & task);
+   // Move the job out of the wrapper and keep the wrapper for the calling worker
+   void unwrap(Task * job, Task & task);
+   // Enqueue a job according to the scheduling mode
+   void enqueue(Task & task);
+   // Enqueue a group of jobs at once
+   void enqueue(std::vector<Task> & tasks);
+   // Enqueue a job to the NUMA node queue
+   void enqueue_on_node(std::size_t node, Task & task);
+   // Enqueue a job to the queue of the priority level
+   void enqueue(Priority priority, Task & task);
+   // Enqueue a job with a deadline, the state is cancelled when the job is dropped
+   void enqueue(std::chrono::steady_clock::time_point deadline, Task & task, FutureStateBase * state);
+   // Return the NUMA node queue of the calling thread
+   std::size_t current_node();
+   // Wake up to n parked workers
+   void wakeup(std::size_t n);
+   // Run a job passing its exception to the exception handler
+   void execute(Task & task);
+   // Enqueue the continuation of a completed future, dropped after shutdown
+   void schedule(Task & task) override;
+   // Destroy the jobs left in the queues after shutdown
+   void drain();
+   // Queue a woken fiber to be resumed by a worker
+   void resume_fiber(Fiber * fiber);
+   // Wait for the future state, a worker of the pool runs other jobs meanwhile
+   void help(FutureStateBase & state);
+   // Account a finished job and notify wait_idle() callers when it was the last one
+   void finish();
+   // Allocate worker slots for the maximum number of workers
+   void allocate_workers();
+   // Start the worker thread in the slot and bind it according to the affinity policy
+   void start_worker(std::size_t index);
+   // Start workers in free slots until the target number of workers is running
+   void spawn_workers();
+   // Check if there are more workers than the target, so one of them should retire
+   inline bool surplus() {
+      return live_threads.load(std::memory_order_relaxed) >
+             target_threads.load(std::memory_order_relaxed) + compensating.load(std::memory_order_relaxed);
+   }
+   // Retire the calling worker when the pool has too many of them
+   bool retire(std::size_t index);
+   // Lower the target number of workers after a keep-alive timeout of an idle worker
+   void expire();
+   // Start an extra worker when a worker of the pool enters a blocking section, returns true if it did
+   bool compensate();
+   // Let the extra worker retire when the blocking section ends
+   void decompensate();
+   // Grow an elastic pool when jobs wait in the queues for too long
+   void supervise();
+   // Add a one-shot timer releasing the task into the job queue at the time point
+   TimerId add_timer(std::chrono::steady_clock::time_point when, Task & task);
+   // Add a periodic timer releasing a call of the function every period
+   TimerId add_timer(std::chrono::steady_clock::time_point when, std::chrono::steady_clock::duration period,
+                     std::shared_ptr<std::function<void()>> func);
+   // Start the timer thread with the wheel if it is not running yet, called with timer_mutex held
+   void start_timers();
+   // Release expired timers into the job queues in batches
+   void run_timers();
+   // Checks if any queue has a job, ordered against wakeup() for parking
+   bool has_job();
+   // Checks if any queue has a job, used for spinning
+   bool any_job();
+   // Checks if any queue of Normal jobs has a job
+   bool any_normal_job();
+   // Return the number of queued Normal jobs
+   std::size_t normal_size();
+
 public:
    // Default ctor
-   ThreadPool(const std::size_t threads_num = std::thread::hardware_concurrency());
+   ThreadPool(const std::size_t threads_num = std::thread::hardware_concurrency(), Scheduling mode = Scheduling::Global);
    // Remove copy ctors
    ThreadPool(const ThreadPool &) = delete;
    ThreadPool(ThreadPool &&) = delete;
 
-   // Defeult dtor
-   ~ThreadPool(){ shutdown(); };
+   // Defeult dtor, futures of the pool may outlive it, but then() must not be called on
+   // them afterwards, as their continuations would be scheduled on the destroyed pool
+   ~ThreadPool();
 
    // Remove default operators
    ThreadPool & operator=(const ThreadPool &) = delete;
@@ -84,44 +330,358 @@ public:
 
    // Inits thread pool
    void init(bool cpuaffinity = false);
+   // Inits thread pool with workers bound to CPUs according to the affinity policy
+   void init(Affinity affinity);
 
    // Shutdowns the pool waiting for current tasks finish
    void shutdown(bool abort = false);
 
    // Submit a function to be executed asynchronously by the pool
    template<typename F, typename...Args>
-   auto submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
-      // Create a function with bounded parameters ready to execute
-      std::function<decltype(f(args...))()> func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-      // Encapsulate it into a shared ptr in order to be able to copy construct / assign
-      auto task_ptr = std::make_shared<std::packaged_task<decltype(f(args...))()>>(func);
+   auto submit(F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      Future<decltype(f(args...))> future;
+
+      // Create a task with bounded parameters and its future state in a single control block
+      Task task = make_task(std::bind(std::forward<F>(f), std::forward<Args>(args)...), future, this);
 
-      // Wrap packaged task into void function
-      std::function<void()> wrapper_func = [task_ptr]() {
-         (*task_ptr)();
-      };
+      // Enqueue the task and wake up a thread if its waiting
+      enqueue(task);
 
-      // Enqueue generic wrapper function
-      job_queue.enqueue(wrapper_func);
+      // Return future of the task
+      return future;
+   }
 
-      // Wake up one thread if its waiting
-      waitcv.notify_one();
+   // Submit a function to be executed asynchronously by the pool at the priority level
+   template<typename F, typename...Args>
+   auto submit(Priority priority, F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      Future<decltype(f(args...))> future;
 
-      // Return future from promise
-      return task_ptr->get_future();
+      // Create a task with bounded parameters and its future state in a single control block
+      Task task = make_task(std::bind(std::forward<F>(f), std::forward<Args>(args)...), future, this);
+
+      // Enqueue the task to the level queue and wake up a thread if its waiting
+      enqueue(priority, task);
+
+      // Return future of the task
+      return future;
+   }
+
+   // Submit a function which should finish before the deadline, in modes other than
+   // Scheduling::Deadline it is the same as submit
+   template<typename F, typename...Args>
+   auto submit(std::chrono::steady_clock::time_point deadline, F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      Future<decltype(f(args...))> future;
+
+      // Create a task with bounded parameters and its future state in a single control block
+      Task task = make_task(std::bind(std::forward<F>(f), std::forward<Args>(args)...), future, this);
+
+      // Enqueue the task by its deadline and wake up a thread if its waiting
+      enqueue(deadline, task, future.state);
+
+      // Return future of the task
+      return future;
    }
 
+   // Submit a function to be executed by a worker of the NUMA node, in modes other than
+   // Scheduling::Numa it is the same as submit
+   template<typename F, typename...Args>
+   auto submit_on_node(std::size_t node, F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      Future<decltype(f(args...))> future;
+
+      // Create a task with bounded parameters and its future state in a single control block
+      Task task = make_task(std::bind(std::forward<F>(f), std::forward<Args>(args)...), future, this);
+
+      // Enqueue the task and wake up a thread if its waiting
+      enqueue_on_node(node, task);
+
+      // Return future of the task
+      return future;
+   }
+
+   // Post a function to be executed asynchronously by the pool without a future,
+   // exceptions thrown by the function are passed to the pool exception handler
+   template<typename F, typename...Args>
+   void post(F&& f, Args&&... args) {
+      // Bound function is stored directly in the task
+      Task task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+      // Enqueue the task and wake up a thread if its waiting
+      enqueue(task);
+   }
+
+   // Post a function to be executed asynchronously by the pool at the priority level
+   template<typename F, typename...Args>
+   void post(Priority priority, F&& f, Args&&... args) {
+      // Bound function is stored directly in the task
+      Task task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+      // Enqueue the task to the level queue and wake up a thread if its waiting
+      enqueue(priority, task);
+   }
+
+   // Post a function which should finish before the deadline, in modes other than
+   // Scheduling::Deadline it is the same as post
+   template<typename F, typename...Args>
+   void post(std::chrono::steady_clock::time_point deadline, F&& f, Args&&... args) {
+      // Bound function is stored directly in the task
+      Task task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+      // Enqueue the task by its deadline and wake up a thread if its waiting
+      enqueue(deadline, task, nullptr);
+   }
+
+   // Submit a function to be executed at the time point
+   template<typename F, typename...Args>
+   auto submit_at(std::chrono::steady_clock::time_point when, F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      Future<decltype(f(args...))> future;
+
+      // Create a task with bounded parameters and its future state in a single control block
+      Task task = make_task(std::bind(std::forward<F>(f), std::forward<Args>(args)...), future, this);
+
+      // The timer moves the task to the job queue when it expires
+      add_timer(when, task);
+
+      // Return future of the task
+      return future;
+   }
+
+   // Submit a function to be executed after the delay
+   template<typename Rep, typename Period, typename F, typename...Args>
+   auto submit_after(const std::chrono::duration<Rep, Period> & delay, F&& f, Args&&... args) -> Future<decltype(f(args...))> {
+      return submit_at(std::chrono::steady_clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+   }
+
+   // Post a function to be executed at the time point, returns id to cancel it
+   template<typename F, typename...Args>
+   TimerId post_at(std::chrono::steady_clock::time_point when, F&& f, Args&&... args) {
+      // Bound function is stored directly in the task
+      Task task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+      return add_timer(when, task);
+   }
+
+   // Post a function to be executed after the delay, returns id to cancel it
+   template<typename Rep, typename Period, typename F, typename...Args>
+   TimerId post_after(const std::chrono::duration<Rep, Period> & delay, F&& f, Args&&... args) {
+      return post_at(std::chrono::steady_clock::now() + delay, std::forward<F>(f), std::forward<Args>(args)...);
+   }
+
+   // Post a function to be executed every period until the timer is cancelled, calls can
+   // overlap when a call takes longer than the period
+   template<typename Rep, typename Period, typename F, typename...Args>
+   TimerId submit_every(const std::chrono::duration<Rep, Period> & period, F&& f, Args&&... args) {
+      auto func = std::make_shared<std::function<void()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+      const auto p = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+
+      return add_timer(std::chrono::steady_clock::now() + p, p, std::move(func));
+   }
+
+   // Cancel a pending delayed or periodic job, returns false when it was already released
+   bool cancel_timer(TimerId id);
+
+   // Submit a range of callables with a single queue operation and a single wakeup,
+   // returns futures of all callables in the range order
+   template<typename It>
+   auto submit_bulk(It first, It last) -> std::vector<Future<decltype((*first)())>> {
+      std::vector<Future<decltype((*first)())>> futures;
+      std::vector<Task> tasks;
+
+      for (; first != last; ++first) {
+         futures.emplace_back();
+         tasks.push_back(make_task(*first, futures.back(), this));
+      }
+      enqueue(tasks);
+
+      return futures;
+   }
+
+   // Submit a range of callables with a single queue operation and a single wakeup,
+   // returns an aggregate future which gets ready when all callables finish
+   template<typename It>
+   Future<void> submit_bulk_all(It first, It last) {
+      using F = typename std::decay<decltype(*first)>::type;
+      const auto n = static_cast<std::size_t>(std::distance(first, last));
+      BulkState * state = new BulkState(n > 0 ? n : 1);
+      Future<void> future(state);
+      std::vector<Task> tasks;
+
+      state->executor = this;
+      if (n == 0) {
+         state->finish();
+         return future;
+      }
+      tasks.reserve(n);
+      for (; first != last; ++first) {
+         tasks.emplace_back(BulkRunner<F>(state, *first));
+      }
+      enqueue(tasks);
+
+      return future;
+   }
+
+   // Post a range of callables with a single queue operation and a single wakeup
+   template<typename It>
+   void post_bulk(It first, It last) {
+      std::vector<Task> tasks;
+
+      for (; first != last; ++first) {
+         tasks.emplace_back(*first);
+      }
+      enqueue(tasks);
+   }
+
+#ifdef THREADPOOL_COROUTINES
+   // Awaitable which resumes the awaiting coroutine on a worker, the resumption is the job
+   class ScheduleAwaiter {
+   private:
+      ThreadPool * pool;
+
+   public:
+      explicit ScheduleAwaiter(ThreadPool * p) noexcept : pool(p) {};
+      inline bool await_ready() const noexcept { return false; }
+      inline void await_suspend(std::coroutine_handle<> handle)
+      {
+         Task task([handle]{ handle.resume(); });
+         pool->enqueue(task);
+      }
+      inline void await_resume() const noexcept {}
+   };
+
+   // Return the awaitable moving the coroutine onto the pool: co_await pool.schedule()
+   inline ScheduleAwaiter schedule() noexcept { return ScheduleAwaiter(this); }
+
+#endif
+   // Guard of a blocking section, the pool keeps an extra worker running while it exists
+   class BlockingSection {
+   private:
+      ThreadPool * pool;
+      bool compensated;
+
+   public:
+      explicit BlockingSection(ThreadPool * p) : pool(p), compensated(p->compensate()) {};
+      BlockingSection(BlockingSection && other) noexcept : pool(other.pool), compensated(other.compensated) {
+         other.compensated = false;
+      }
+      BlockingSection(const BlockingSection &) = delete;
+      ~BlockingSection() {
+         if (compensated) {
+            pool->decompensate();
+         }
+      }
+   };
+
+   // Tell the pool that the calling job is about to block, for I/O or on a future, until the
+   // returned guard is destroyed. When no other worker is idle the pool starts an extra one,
+   // up to the limit set by set_compensation(), which retires after the section ends. Called
+   // outside of the workers of the pool it does nothing.
+   inline BlockingSection blocking_section() { return BlockingSection(this); }
+
+   // Wait until the future is ready. Called from a job running in the pool, the worker runs
+   // other queued jobs meanwhile, its own ones first, so jobs waiting for their subtasks
+   // neither hold the worker nor deadlock the pool. Waits nested deeper than max_help_depth
+   // and waits on fibers block in a blocking section. Elsewhere it is the same as
+   // future.wait().
+   template<typename R>
+   void wait(Future<R> & future) {
+      help(*FutureAccess::state(future));
+   }
+
+   // Wait until every submitted job has finished, jobs submitted while waiting are waited
+   // for too. It must not be called from a job running in the pool. Pending delayed and
+   // periodic jobs are not waited for until their timers release them, see num_timers().
+   void wait_idle();
+
+   // Wait until every submitted job has finished or the timeout expires, returns false on timeout
+   template<class Rep, class Period>
+   bool wait_idle(const std::chrono::duration<Rep, Period> & timeout) {
+      return wait_idle_until(std::chrono::steady_clock::now() + timeout);
+   }
+
+   // Wait until every submitted job has finished or the time point is reached, returns false on timeout
+   bool wait_idle_until(const std::chrono::steady_clock::time_point & deadline);
+
+   // Set the minimum and maximum number of workers of an elastic pool and the time after which
+   // an idle worker above the minimum retires, has to be called before init()
+   void set_limits(std::size_t min, std::size_t max, std::chrono::milliseconds idle_time = std::chrono::milliseconds(60000));
+
+   // Set the maximum number of extra workers running for workers blocked in blocking sections,
+   // has to be called before init()
+   void set_compensation(std::size_t spare);
+
+   // Set the queue depth and the time jobs may wait in queues with all workers busy before
+   // an elastic pool starts a new worker
+   void set_growth(std::size_t queue_depth, std::chrono::milliseconds wait_time);
+
+   // Change the number of workers, bounded by the maximum set by set_limits(), workers
+   // retire after they finish their current jobs
+   void resize(std::size_t n);
+
+   // Set the number of jobs a worker takes from higher priority levels before it serves
+   // a job waiting at a lower level, has to be called before init()
+   void set_priority_aging(std::size_t jobs);
+
+   // Drop jobs which reach a worker after their deadline, their futures are cancelled,
+   // has to be called before init()
+   void set_drop_expired(bool drop);
+
+   // Run every job on a stackful fiber, so jobs blocking in FiberMutex, FiberConditionVariable,
+   // fiber_sleep_for() or fiber_yield() suspend the fiber and not the worker thread,
+   // has to be called before init()
+   void set_fibers(std::size_t stack_size = default_fiber_stack);
+
+   // Set the idle wait policy of workers, has to be called before init()
+   void set_wait_policy(WaitPolicy policy, std::size_t spins = default_spins);
+
+   // Set the handler of exceptions thrown by posted functions, the default one reports to stderr
+   void set_exception_handler(std::function<void(std::exception_ptr)> handler);
+
    // Return the size of the pool
-   inline std::size_t size() { return threads.size(); }
+   inline std::size_t size() { return target_threads; }
+
+   // Return the minimum and maximum size of the pool
+   inline std::size_t min_size() { return min_threads; }
+   inline std::size_t max_size() { return max_threads; }
 
    // Return the size of the job queue
-   inline std::size_t queue_size() { return job_queue.size(); }
+   std::size_t queue_size();
+
+   // Return the number of queued jobs of the priority level
+   std::size_t queue_size(Priority priority);
+
+   // Return the number of NUMA nodes used by the pool
+   inline std::size_t num_nodes() { return node_queues.empty() ? 1 : node_queues.size(); }
+
+   // Return the scheduling mode of the pool
+   inline Scheduling mode() { return scheduling; }
 
    // Return the number of threads available for job execution
-   inline std::size_t num_available() { return available_threads; }
+   std::size_t num_available();
 
    // Return the number of threads running and executing jobs
-   inline std::size_t num_running() { return running_threads; }
+   std::size_t num_running();
+
+   // Return the number of submitted jobs which have not finished yet, jobs of pending timers
+   // are counted once the timers release them
+   inline std::size_t num_outstanding() { return outstanding.load(std::memory_order_relaxed); }
+
+   // Return the number of deadline jobs finished before their deadline
+   std::size_t deadlines_met();
+
+   // Return the number of deadline jobs finished after their deadline or dropped
+   std::size_t deadlines_missed();
+
+   // Return the number of deadline jobs dropped after their deadline
+   std::size_t deadlines_dropped();
+
+   // Return the number of pending delayed and periodic jobs
+   std::size_t num_timers();
+
+   // Return the CPU every worker is bound to, -1 for unbound workers, spare workers of
+   // blocking sections are not included. In the Numa mode workers are bound to all CPUs of
+   // their node and the first of them is reported.
+   inline std::vector<int> affinity_map() {
+      return std::vector<int>(cpu_map.begin(), cpu_map.begin() + std::min(cpu_map.size(), max_threads));
+   }
 };
 
 #endif   /* THREADPOOL_H */
\ No newline at end of file
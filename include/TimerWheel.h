@@ -0,0 +1,100 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   TimerWheel.h
+ *
+ * Hierarchical timing wheel as described in:
+ *  G. Varghese, T. Lauck, "Hashed and Hierarchical Timing Wheels", SOSP 1987
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <chrono>
+#include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Task.h"
+
+
+/*
+ * Four levels of 256 slots, every level covers 256 times the range of the level below,
+ * so with the default 1 ms resolution the wheel spans about 49 days, longer timers are
+ * cascaded again. Timers are nodes of intrusive lists in a slab, so insert and cancel
+ * are O(1) and do not allocate once the slab has grown. The wheel is not thread safe.
+ */
+class TimerWheel {
+public:
+   using Clock = std::chrono::steady_clock;
+   using Id = std::uint64_t;
+
+   // Id never returned for a timer
+   static constexpr Id invalid = 0;
+
+private:
+   static constexpr unsigned levels = 4;
+   static constexpr unsigned bits = 8;
+   static constexpr std::size_t slots = 1 << bits;
+   static constexpr std::int32_t none = -1;
+
+   struct Node {
+      std::int32_t prev { none };
+      std::int32_t next { none };
+      std::uint32_t gen { 0 };
+      std::int16_t level { -1 };          // -1 when the node is free
+      std::uint16_t slot { 0 };
+      std::uint64_t expires { 0 };        // tick
+      std::uint64_t period { 0 };         // ticks, 0 for one-shot timers
+      Task task {};
+      std::shared_ptr<std::function<void()>> func {};
+   };
+
+   std::vector<Node> nodes {};
+   std::int32_t free_list { none };
+   std::int32_t heads[levels][slots];
+   std::uint64_t current { 0 };
+   std::size_t count { 0 };
+   Clock::time_point start;
+   Clock::duration resolution;
+
+   std::int32_t allocate();
+   void release(std::int32_t i);
+   void link(std::int32_t i);
+   void unlink(std::int32_t i);
+   std::int32_t detach(unsigned level, std::size_t slot);
+   void cascade(unsigned level, std::size_t slot);
+   std::uint64_t tick_of(Clock::time_point when) const;
+   std::uint64_t elapsed(Clock::time_point now) const;
+   Id insert(std::int32_t i, Clock::time_point when);
+
+public:
+   explicit TimerWheel(Clock::duration res = std::chrono::milliseconds(1), Clock::time_point origin = Clock::now());
+   TimerWheel(const TimerWheel &) = delete;
+
+   // Add a one-shot timer releasing the task at the time point
+   Id add(Clock::time_point when, Task task);
+
+   // Add a periodic timer releasing a call of the function every period, the first at the time point
+   Id add(Clock::time_point when, Clock::duration period, std::shared_ptr<std::function<void()>> func);
+
+   // Remove a pending timer, returns false when it has already fired or was cancelled
+   bool cancel(Id id);
+
+   // Move tasks of all timers expired until now to the vector and reschedule periodic ones
+   void advance(Clock::time_point now, std::vector<Task> & expired);
+
+   // Return the time the wheel should be advanced at, the maximum time point when empty
+   Clock::time_point next_expiry() const;
+
+   // Return the number of pending timers
+   inline std::size_t size() const { return count; }
+};
+
+#endif   /* TIMERWHEEL_H */
@@ -0,0 +1,68 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Topology.h
+ *
+ * CPU topology discovery based on Linux sysfs and the process affinity mask.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstddef>      /* For std::size_t */
+#include <string>
+#include <vector>
+
+
+/*
+ * Describes CPUs the process is allowed to run on: physical cores, SMT siblings and NUMA
+ * nodes. On systems without sysfs every allowed CPU is a separate core of a single node.
+ */
+class Topology {
+public:
+   struct Cpu {
+      int id;              // logical CPU number
+      int core;            // physical core id, unique within a package
+      int package;         // physical package (socket) id
+      int node;            // NUMA node
+      int thread;          // SMT sibling index within the physical core
+   };
+
+   // Order of CPUs used for worker placement
+   enum class Placement {
+      Spread,              // round-robin across NUMA nodes
+      Pack,                // fill a NUMA node before the next one
+   };
+
+private:
+   std::vector<Cpu> cpu_list {};
+   std::vector<int> node_ids {};
+
+public:
+   // Reads topology from sysfs root, the allowed CPUs default to the process affinity mask
+   explicit Topology(const std::string & sysfs = "/sys/devices/system", const std::vector<int> & allowed = {});
+
+   // Return all allowed CPUs sorted by id
+   inline const std::vector<Cpu> & cpus() const { return cpu_list; }
+
+   // Return ids of NUMA nodes with allowed CPUs
+   inline const std::vector<int> & nodes() const { return node_ids; }
+
+   // Return allowed CPUs of the NUMA node
+   std::vector<int> node_cpus(int node) const;
+
+   // Return NUMA node of the CPU or -1 if the CPU is not allowed
+   int node_of(int cpu) const;
+
+   // Return CPUs in placement order: distinct physical cores first, then their SMT siblings
+   std::vector<int> placement(Placement policy) const;
+
+   // Parse the sysfs cpu list format, i.e. "0-3,8,10-11"
+   static std::vector<int> parse_cpulist(const std::string & list);
+};
+
+#endif   /* TOPOLOGY_H */
@@ -0,0 +1,183 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   WorkStealingDeque.h
+ *
+ * Lock-free Chase-Lev work-stealing deque as described in:
+ *  D. Chase, Y. Lev, "Dynamic Circular Work-Stealing Deque", SPAA 2005
+ *  N.M. Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013
+ */
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cstddef>      /* For std::size_t */
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "CacheLine.h"
+
+
+/*
+ * Single owner / multiple thieves deque. The owner thread pushes and pops at the bottom
+ * while any other thread can steal from the top. The element type has to be trivially
+ * copyable (usually a pointer) as thieves read the slot before they claim it.
+ */
+template <typename T>
+class WorkStealingDeque {
+   static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque requires trivially copyable type");
+
+private:
+   /*
+    * Circular array of atomic slots, the capacity is always a power of two
+    */
+   class Array {
+   private:
+      std::int64_t cap;
+      std::int64_t mask;
+      std::unique_ptr<std::atomic<T>[]> slots;
+
+   public:
+      explicit Array(std::int64_t c) : cap(c), mask(c - 1), slots(new std::atomic<T>[c]) {};
+
+      inline std::int64_t capacity() const { return cap; }
+
+      inline void put(std::int64_t i, T t) { slots[i & mask].store(t, std::memory_order_relaxed); }
+
+      inline T get(std::int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+
+      // allocate twice as large array with all elements in range [t, b) copied
+      inline Array * grow(std::int64_t b, std::int64_t t) const
+      {
+         Array * a = new Array(cap * 2);
+         for (std::int64_t i = t; i != b; i++){
+            a->put(i, get(i));
+         }
+         return a;
+      }
+   };
+
+   alignas(cache_line_size) std::atomic<std::int64_t> top { 0 };
+   alignas(cache_line_size) std::atomic<std::int64_t> bottom { 0 };
+   alignas(cache_line_size) std::atomic<Array*> array;
+   // arrays replaced by grow() can still be read by a concurrent thief, so keep them until dtor
+   std::vector<std::unique_ptr<Array>> garbage {};
+
+public:
+/*
+ * Standard class ctor/dtor
+ */
+   explicit WorkStealingDeque(std::size_t capacity = 1024)
+   {
+      std::size_t c = 1;
+      while (c < capacity){
+         c <<= 1;
+      }
+      array.store(new Array(static_cast<std::int64_t>(c)), std::memory_order_relaxed);
+   };
+   WorkStealingDeque(WorkStealingDeque& other) = delete;
+   ~WorkStealingDeque() { delete array.load(std::memory_order_relaxed); };
+
+/*
+ * Checks if a deque is empty
+ */
+   inline bool empty() const
+   {
+      std::int64_t b = bottom.load(std::memory_order_relaxed);
+      std::int64_t t = top.load(std::memory_order_relaxed);
+      return b <= t;
+   }
+
+/*
+ * Return the (approximate) size of the deque
+ */
+   inline std::size_t size() const
+   {
+      std::int64_t b = bottom.load(std::memory_order_relaxed);
+      std::int64_t t = top.load(std::memory_order_relaxed);
+      return static_cast<std::size_t>(b >= t ? b - t : 0);
+   }
+
+/*
+ * Add an object at the bottom of the deque, owner thread only
+ */
+   inline void push(T t)
+   {
+      std::int64_t b = bottom.load(std::memory_order_relaxed);
+      std::int64_t tp = top.load(std::memory_order_acquire);
+      Array * a = array.load(std::memory_order_relaxed);
+
+      if (b - tp > a->capacity() - 1) {
+         // deque is full, so grow the array
+         Array * n = a->grow(b, tp);
+         garbage.emplace_back(a);
+         array.store(n, std::memory_order_release);
+         a = n;
+      }
+
+      a->put(b, t);
+      std::atomic_thread_fence(std::memory_order_release);
+      bottom.store(b + 1, std::memory_order_relaxed);
+   }
+
+/*
+ * Remove and return the object from the bottom of the deque, owner thread only
+ */
+   inline bool pop(T& t)
+   {
+      std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+      Array * a = array.load(std::memory_order_relaxed);
+      bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::int64_t tp = top.load(std::memory_order_relaxed);
+
+      if (tp > b) {
+         // deque was empty
+         bottom.store(b + 1, std::memory_order_relaxed);
+         return false;
+      }
+
+      t = a->get(b);
+      if (tp == b) {
+         // the last element, race against thieves
+         bool won = top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+         bottom.store(b + 1, std::memory_order_relaxed);
+         return won;
+      }
+
+      return true;
+   }
+
+/*
+ * Remove and return the object from the top of the deque, any thread
+ */
+   inline bool steal(T& t)
+   {
+      std::int64_t tp = top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::int64_t b = bottom.load(std::memory_order_acquire);
+
+      if (tp >= b) {
+         return false;
+      }
+
+      Array * a = array.load(std::memory_order_consume);
+      T item = a->get(tp);
+      if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+         // lost the race with other thief or owner
+         return false;
+      }
+
+      t = item;
+      return true;
+   }
+};
+
+#endif   /* WORKSTEALINGDEQUE_H */
@@ -0,0 +1,404 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Fiber.cpp
+ *
+ * Fiber scheduler of the ThreadPool workers built on ucontext and the fiber aware
+ * blocking primitives.
+ */
+
+#include "config.h"
+#ifdef HAVE_UCONTEXT_H
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+#include <stdexcept>
+#include <thread>
+#include "Fiber.h"
+#include "ThreadPool.h"
+
+#if defined MAP_ANON && !defined MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// finished fibers kept by a worker before they go back to the pool
+static const std::size_t fiber_cache_size = 64;
+
+// scheduler of the calling worker thread
+static thread_local FiberScheduler * thread_scheduler = nullptr;
+
+#ifdef HAVE_UCONTEXT_H
+
+struct FiberScheduler::Context {
+   ucontext_t context;
+};
+
+struct Fiber {
+   ucontext_t context;
+   char * memory { nullptr };          // guard page and stack
+   std::size_t size { 0 };
+   Task task {};
+   ThreadPool * pool { nullptr };
+   FiberScheduler * scheduler { nullptr };   // the one running the fiber now
+   std::mutex park {};                 // held from parking until switched out
+   bool finished { false };
+   bool yielding { false };
+};
+
+/*
+ *
+ */
+bool FiberScheduler::supported()
+{
+   return true;
+}
+
+/*
+ *
+ */
+FiberScheduler::FiberScheduler(ThreadPool * p, std::size_t stack)
+   : pool(p), stack_size(stack), context(new Context)
+{
+   thread_scheduler = this;
+}
+
+/*
+ * Cached fibers go back to the pool, as the worker can retire before the pool ends.
+ */
+FiberScheduler::~FiberScheduler()
+{
+   thread_scheduler = nullptr;
+
+   std::lock_guard<std::mutex> lock(pool->fiber_mutex);
+   pool->fiber_free.insert(pool->fiber_free.end(), cache.begin(), cache.end());
+}
+
+/*
+ * The stack is mapped with a guard page below it, so an overflow faults instead of
+ * silently corrupting other memory.
+ */
+Fiber * FiberScheduler::acquire()
+{
+   if (!cache.empty()) {
+      Fiber * fiber = cache.back();
+      cache.pop_back();
+      return fiber;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(pool->fiber_mutex);
+      if (!pool->fiber_free.empty()) {
+         Fiber * fiber = pool->fiber_free.back();
+         pool->fiber_free.pop_back();
+         return fiber;
+      }
+   }
+
+   const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+   const std::size_t size = (stack_size + page - 1) / page * page + page;
+   void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (memory == MAP_FAILED) {
+      throw std::bad_alloc();
+   }
+   mprotect(memory, page, PROT_NONE);
+
+   std::unique_ptr<Fiber> fiber(new Fiber);
+   fiber->memory = static_cast<char *>(memory);
+   fiber->size = size;
+   fiber->pool = pool;
+   getcontext(&fiber->context);
+   fiber->context.uc_stack.ss_sp = fiber->memory + page;
+   fiber->context.uc_stack.ss_size = size - page;
+   fiber->context.uc_link = nullptr;
+   makecontext(&fiber->context, &FiberScheduler::entry, 0);
+
+   std::lock_guard<std::mutex> lock(pool->fiber_mutex);
+   pool->fiber_all.push_back(fiber.get());
+   return fiber.release();
+}
+
+/*
+ *
+ */
+void FiberScheduler::release(Fiber * fiber)
+{
+   if (cache.size() < fiber_cache_size) {
+      cache.push_back(fiber);
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(pool->fiber_mutex);
+   pool->fiber_free.push_back(fiber);
+}
+
+/*
+ *
+ */
+void FiberScheduler::destroy(Fiber * fiber)
+{
+   fiber->task.reset();
+   munmap(fiber->memory, fiber->size);
+   delete fiber;
+}
+
+/*
+ * A fiber runs jobs in a loop, after a job it switches back to the scheduler which
+ * resumed it last and waits to be reused.
+ */
+void FiberScheduler::entry()
+{
+   Fiber * self = thread_scheduler->current;
+
+   for (;;) {
+      self->pool->execute(self->task);
+      self->task.reset();
+      self->finished = true;
+      swapcontext(&self->context, &self->scheduler->context->context);
+   }
+}
+
+/*
+ * The park lock of a suspended fiber is released here, once its context is saved. The
+ * fiber fields must not be touched afterwards, as another worker can resume it already.
+ */
+bool FiberScheduler::switch_to(Fiber * fiber)
+{
+   fiber->scheduler = this;
+   current = fiber;
+   swapcontext(&context->context, &fiber->context);
+   current = nullptr;
+
+   if (fiber->finished) {
+      fiber->finished = false;
+      release(fiber);
+      return true;
+   }
+
+   const bool yielding = fiber->yielding;
+   fiber->yielding = false;
+   fiber->park.unlock();
+   if (yielding) {
+      pool->resume_fiber(fiber);
+   }
+   return false;
+}
+
+/*
+ *
+ */
+bool FiberScheduler::run(Task & task)
+{
+   Fiber * fiber = acquire();
+
+   fiber->task = std::move(task);
+   return switch_to(fiber);
+}
+
+/*
+ *
+ */
+void FiberScheduler::suspend(Fiber * fiber)
+{
+   swapcontext(&fiber->context, &fiber->scheduler->context->context);
+}
+
+/*
+ *
+ */
+Fiber * FiberScheduler::running()
+{
+   return thread_scheduler != nullptr ? thread_scheduler->current : nullptr;
+}
+
+/*
+ *
+ */
+void FiberScheduler::park(std::unique_lock<std::mutex> & lock)
+{
+   Fiber * fiber = running();
+
+   fiber->park.lock();
+   lock.unlock();
+   suspend(fiber);
+}
+
+/*
+ * Waits for the fiber to be switched out, when it is still parking.
+ */
+void FiberScheduler::wake(Fiber * fiber)
+{
+   {
+      std::lock_guard<std::mutex> lock(fiber->park);
+   }
+   fiber->pool->resume_fiber(fiber);
+}
+
+/*
+ *
+ */
+void FiberScheduler::sleep(Fiber * fiber, std::chrono::steady_clock::duration time)
+{
+   Task task([fiber]{ FiberScheduler::wake(fiber); });
+
+   fiber->park.lock();
+   fiber->pool->add_timer(std::chrono::steady_clock::now() + time, task);
+   suspend(fiber);
+}
+
+/*
+ *
+ */
+void FiberScheduler::yield(Fiber * fiber)
+{
+   fiber->park.lock();
+   fiber->yielding = true;
+   suspend(fiber);
+}
+
+#else
+
+struct FiberScheduler::Context {};
+struct Fiber {};
+
+bool FiberScheduler::supported() { return false; }
+FiberScheduler::FiberScheduler(ThreadPool * p, std::size_t stack) : pool(p), stack_size(stack)
+{
+   throw std::logic_error("fibers are not supported on this platform");
+}
+FiberScheduler::~FiberScheduler() {}
+bool FiberScheduler::run(Task &) { return true; }
+bool FiberScheduler::switch_to(Fiber *) { return true; }
+void FiberScheduler::destroy(Fiber *) {}
+Fiber * FiberScheduler::running() { return nullptr; }
+void FiberScheduler::park(std::unique_lock<std::mutex> &) {}
+void FiberScheduler::wake(Fiber *) {}
+void FiberScheduler::sleep(Fiber *, std::chrono::steady_clock::duration) {}
+void FiberScheduler::yield(Fiber *) {}
+
+#endif   /* HAVE_UCONTEXT_H */
+
+/*
+ *
+ */
+void FiberMutex::lock()
+{
+   std::unique_lock<std::mutex> l(guard);
+
+   if (!locked) {
+      locked = true;
+      return;
+   }
+
+   FiberWaiter waiter;
+   waiters.push_back(&waiter);
+   waiter.wait(l);
+}
+
+/*
+ *
+ */
+bool FiberMutex::try_lock()
+{
+   std::lock_guard<std::mutex> l(guard);
+
+   if (locked) {
+      return false;
+   }
+   locked = true;
+   return true;
+}
+
+/*
+ * The mutex stays locked when it is handed over to a waiter.
+ */
+void FiberMutex::unlock()
+{
+   std::lock_guard<std::mutex> l(guard);
+
+   if (waiters.empty()) {
+      locked = false;
+      return;
+   }
+
+   FiberWaiter * waiter = waiters.front();
+   waiters.pop_front();
+   waiter->notify();
+}
+
+/*
+ * The waiter is registered before the mutex is released, so no notify can be missed.
+ */
+void FiberConditionVariable::wait(std::unique_lock<FiberMutex> & lock)
+{
+   std::unique_lock<std::mutex> l(guard);
+   FiberWaiter waiter;
+
+   waiters.push_back(&waiter);
+   lock.unlock();
+   waiter.wait(l);
+   if (l.owns_lock()) {
+      l.unlock();
+   }
+   lock.lock();
+}
+
+/*
+ *
+ */
+void FiberConditionVariable::notify_one()
+{
+   std::lock_guard<std::mutex> l(guard);
+
+   if (!waiters.empty()) {
+      FiberWaiter * waiter = waiters.front();
+      waiters.pop_front();
+      waiter->notify();
+   }
+}
+
+/*
+ *
+ */
+void FiberConditionVariable::notify_all()
+{
+   std::lock_guard<std::mutex> l(guard);
+
+   while (!waiters.empty()) {
+      FiberWaiter * waiter = waiters.front();
+      waiters.pop_front();
+      waiter->notify();
+   }
+}
+
+/*
+ *
+ */
+void fiber_sleep_for(std::chrono::steady_clock::duration time)
+{
+   Fiber * fiber = FiberScheduler::running();
+
+   if (fiber == nullptr) {
+      std::this_thread::sleep_for(time);
+   } else {
+      FiberScheduler::sleep(fiber, time);
+   }
+}
+
+/*
+ *
+ */
+void fiber_yield()
+{
+   Fiber * fiber = FiberScheduler::running();
+
+   if (fiber == nullptr) {
+      std::this_thread::yield();
+   } else {
+      FiberScheduler::yield(fiber);
+   }
+}
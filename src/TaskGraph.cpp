@@ -0,0 +1,195 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   TaskGraph.cpp
+ *
+ * Dependency counting executor of job graphs.
+ */
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include "TaskGraph.h"
+
+/*
+ *
+ */
+TaskGraph::Node TaskGraph::add(std::function<void()> func)
+{
+   nodes.push_back(Vertex { std::move(func) });
+   order.clear();
+   return nodes.size() - 1;
+}
+
+/*
+ *
+ */
+void TaskGraph::add_edge(Node from, Node to)
+{
+   if (from >= nodes.size() || to >= nodes.size()) {
+      throw std::out_of_range("TaskGraph: no such node");
+   }
+
+   nodes[from].successors.push_back(to);
+   nodes[to].predecessors++;
+   order.clear();
+}
+
+/*
+ * Kahn's algorithm, a cycle leaves some nodes out of the order.
+ */
+void TaskGraph::prepare()
+{
+   const std::size_t n = nodes.size();
+
+   if (pending_size < n) {
+      pending.reset(new std::atomic_size_t[n]);
+      pending_size = n;
+   }
+   if (!order.empty() || n == 0) {
+      return;
+   }
+
+   std::vector<std::size_t> count(n);
+   roots.clear();
+   for (Node i = 0; i < n; i++) {
+      count[i] = nodes[i].predecessors;
+      if (count[i] == 0) {
+         order.push_back(i);
+         roots.push_back(Start(this, i, false));
+      }
+   }
+   for (std::size_t k = 0; k < order.size(); k++) {
+      for (auto s : nodes[order[k]].successors) {
+         if (--count[s] == 0) {
+            order.push_back(s);
+         }
+      }
+   }
+
+   if (order.size() != n) {
+      order.clear();
+      throw std::logic_error("TaskGraph: dependency cycle");
+   }
+}
+
+/*
+ *
+ */
+Future<void> TaskGraph::run(ThreadPool & pool)
+{
+   const std::size_t n = nodes.size();
+
+   prepare();
+
+   BulkState * s = new BulkState(n > 0 ? n : 1);
+   Future<void> future(s);
+
+   s->executor = &pool;
+   if (n == 0) {
+      s->finish();
+      return future;
+   }
+
+   for (Node i = 0; i < n; i++) {
+      pending[i].store(nodes[i].predecessors, std::memory_order_relaxed);
+   }
+   this->pool = &pool;
+   state = s;
+   failed.store(false, std::memory_order_relaxed);
+   origin = Clock::now();
+
+   // posting publishes the counters to the workers
+   pool.post_bulk(roots.begin(), roots.end());
+   return future;
+}
+
+/*
+ * The first successor which got ready runs on this thread without a trip through the
+ * queue. The graph is not touched after the last node finishes, as the caller can
+ * destroy it then.
+ */
+void TaskGraph::execute(Node node)
+{
+   for (;;) {
+      Vertex & v = nodes[node];
+      Node next = nodes.size();
+
+      v.start = Clock::now() - origin;
+      if (!failed.load(std::memory_order_relaxed)) {
+         try {
+            v.func();
+         } catch (...) {
+            failed.store(true, std::memory_order_relaxed);
+            state->fail(std::current_exception());
+         }
+      }
+      v.finish = Clock::now() - origin;
+
+      for (auto s : v.successors) {
+         if (pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (next == nodes.size()) {
+               next = s;
+            } else {
+               pool->post(Start(this, s));
+            }
+         }
+      }
+
+      const bool last = next == nodes.size();
+      state->finish();
+      if (last) {
+         return;
+      }
+      node = next;
+   }
+}
+
+/*
+ * The run fails with broken_promise. The successors are counted down as if the node had
+ * finished, the ones which get ready are skipped the same way, so every node is finished
+ * exactly once and the graph is not touched after the last one.
+ */
+void TaskGraph::abandon(Node node)
+{
+   std::vector<Node> skipped { node };
+
+   failed.store(true, std::memory_order_relaxed);
+   state->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+
+   while (!skipped.empty()) {
+      Node n = skipped.back();
+      skipped.pop_back();
+      for (auto s : nodes[n].successors) {
+         if (pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            skipped.push_back(s);
+         }
+      }
+      state->finish();
+   }
+}
+
+/*
+ * Nodes in topological order have their predecessors' paths computed already.
+ */
+TaskGraph::Clock::duration TaskGraph::critical_path()
+{
+   prepare();
+
+   std::vector<Clock::duration> path(nodes.size(), Clock::duration::zero());
+   Clock::duration longest = Clock::duration::zero();
+
+   for (auto i : order) {
+      const Clock::duration total = path[i] + elapsed(i);
+      longest = std::max(longest, total);
+      for (auto s : nodes[i].successors) {
+         path[s] = std::max(path[s], total);
+      }
+   }
+
+   return longest;
+}
@@ -57,74 +57,1093 @@
 #include <mach/thread_policy.h>
 #include <mach/thread_act.h>
 #endif
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
 #include "ThreadPool.h"
 
+// worker context of the calling thread used to route nested submits into the local deque
+static thread_local ThreadPool * worker_pool = nullptr;
+static thread_local std::size_t worker_index = 0;
+
+/*
+ *
+ */
+ThreadPool::ThreadWorker::ThreadWorker(ThreadPool * pool, std::size_t idx)
+   : ptr(pool), index(idx), seed(0x9E3779B97F4A7C15ULL * (idx + 1)) {};
+
+// limits of the adaptive spin count
+static const std::size_t min_spins = 16;
+static const std::size_t max_spins = 65536;
+// number of yields between spinning and parking
+static const std::size_t max_yields = 8;
+// time a helping worker waits on the future before it looks for new jobs again
+static const std::chrono::microseconds help_wait(200);
+// number of deque wrappers a worker keeps for reuse
+static const std::size_t max_free_tasks = 256;
+
+/*
+ * Hints the processor that the thread is in a spin-wait loop.
+ */
+static inline void cpu_relax()
+{
+#if defined __x86_64__ || defined __i386__
+   __builtin_ia32_pause();
+#elif defined __aarch64__ || defined __arm__
+   asm volatile("yield" ::: "memory");
+#elif defined __sparc__
+   asm volatile("membar #LoadLoad" ::: "memory");
+#else
+   std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/*
+ * The pool mutex is used for parking only, the jobs are taken from the queues without it.
+ */
+void ThreadPool::ThreadWorker::operator()()
+{
+   Task task;
+   Fiber * fiber;
+   WorkerState & state = ptr->worker_state[index];
+   std::unique_ptr<FiberScheduler> fibers;
+
+   // signal thread avaliability
+   state.worker = this;
+   state.available = true;
+
+   worker_pool = ptr;
+   worker_index = index;
+   spin_limit = ptr->wait_policy == WaitPolicy::Park ? 0 : ptr->spin_count;
+   if (ptr->fiber_stack > 0) {
+      fibers.reset(new FiberScheduler(ptr, ptr->fiber_stack));
+   }
+
+   while (!ptr->shut_flag)
+   {
+      // woken fibers go first, they hold jobs started already
+      if (fibers && ptr->ready_fibers.dequeue(fiber)) {
+         // signal work start, only once there is work in hand
+         state.running = true;
+         const bool finished = fibers->resume(fiber);
+         state.running = false;
+         if (finished) {
+            ptr->finish();
+         }
+         continue;
+      }
+
+      if (next_job(task)) {
+         state.running = true;
+         // a job blocked on a fiber finishes later on any worker
+         const bool finished = fibers ? fibers->run(task) : (ptr->execute(task), true);
+         // signal work done
+         state.running = false;
+         if (finished) {
+            account(state);
+         }
+         timed = false;
+         if (finished) {
+            ptr->finish();
+         }
+         if (ptr->surplus() && ptr->retire(index)) {
+            break;
+         }
+         continue;
+      }
+
+      if (ptr->surplus() && ptr->retire(index)) {
+         break;
+      }
+
+      idle();
+   }
+
+   worker_pool = nullptr;
+
+   // signal thread exit
+   state.available = false;
+   state.worker = nullptr;
+   state.active = false;
+};
+
+/*
+ * Counts a finished deadline job as met or missed.
+ */
+void ThreadPool::ThreadWorker::account(WorkerState & state)
+{
+   if (timed) {
+      auto &c = std::chrono::steady_clock::now() <= deadline ? state.met : state.missed;
+      c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   }
+}
+
+/*
+ * Runs the jobs the way the worker loop does, nested in the waiting job, so the deadline
+ * of the waiting job is put aside meanwhile. With nothing to run the worker waits on the
+ * state for a short time and looks again, the awaited job can depend on jobs which are
+ * not queued yet. Jobs taken from FIFO queues can wait and help again, so the nesting is
+ * bounded to keep the stack, deeper waits and waits on the small fiber stacks block with
+ * an extra worker compensating instead.
+ */
+void ThreadPool::ThreadWorker::help(FutureStateBase & awaited)
+{
+   WorkerState & state = ptr->worker_state[index];
+   const bool waiting_timed = timed;
+   const auto waiting_deadline = deadline;
+   std::size_t misses = 0;
+   Task task;
+
+   if (helping >= max_help_depth || FiberScheduler::running() != nullptr) {
+      auto guard = ptr->blocking_section();
+      awaited.wait();
+      return;
+   }
+
+   helping++;
+   while (!awaited.is_ready()) {
+      timed = false;
+      if (next_help(task)) {
+         ptr->execute(task);
+         account(state);
+         ptr->finish();
+         misses = 0;
+         continue;
+      }
+
+      if (++misses <= max_yields) {
+         std::this_thread::yield();
+      } else {
+         awaited.wait_until(std::chrono::steady_clock::now() + help_wait);
+      }
+   }
+
+   helping--;
+   timed = waiting_timed;
+   deadline = waiting_deadline;
+}
+
+/*
+ * Waits for a new job or shutdown notification. Depending on the wait policy the worker
+ * spins and yields before it parks on the pool condition variable. In the adaptive policy
+ * the spin count grows when spinning finds a job and shrinks when the worker has to park.
+ */
+void ThreadPool::ThreadWorker::idle()
+{
+   ThreadPool * poolptr = ptr;      // a little local helper
+
+   for (std::size_t n = 0; n < spin_limit; n++) {
+      cpu_relax();
+      if (ptr->any_job() || ptr->shut_flag) {
+         if (ptr->wait_policy == WaitPolicy::Adaptive && spin_limit < max_spins) {
+            spin_limit *= 2;
+         }
+         return;
+      }
+   }
+
+   if (ptr->wait_policy != WaitPolicy::Park) {
+      for (std::size_t n = 0; n < max_yields; n++) {
+         std::this_thread::yield();
+         if (ptr->any_job() || ptr->shut_flag) {
+            return;
+         }
+      }
+      if (ptr->wait_policy == WaitPolicy::Adaptive && spin_limit > min_spins) {
+         spin_limit /= 2;
+      }
+   }
+
+   // nothing to do, so park until new job, resize or shutdown notification
+   auto wake = [poolptr]
+      {
+         return poolptr->shut_flag || poolptr->has_job() || poolptr->surplus();
+      };
+   std::unique_lock<std::mutex> lock(ptr->mutex);
+   ptr->sleeping_threads++;
+   if (ptr->target_threads > ptr->min_threads) {
+      // an elastic pool above its minimum retires workers idle for the keep-alive time
+      if (!ptr->waitcv.wait_for(lock, ptr->keep_alive, wake)) {
+         ptr->expire();
+      }
+   } else {
+      ptr->waitcv.wait(lock, wake);
+   }
+   ptr->sleeping_threads--;
+}
+
+/*
+ * Pools which never got a High or Low job use the Normal queues only, so the priority
+ * levels cost a single flag check.
+ */
+bool ThreadPool::ThreadWorker::next_job(Task & task)
+{
+   if (ptr->prioritized.load(std::memory_order_relaxed)) {
+      return next_prioritized(task);
+   }
+
+   return next_normal(task);
+}
+
+/*
+ * Levels are served in strict priority order. Every job taken from a higher level while
+ * a lower one waits ages the lower level, after aging such jobs the lower level is served
+ * once, so a stream of High jobs cannot starve the others.
+ */
+bool ThreadPool::ThreadWorker::next_prioritized(Task & task)
+{
+   if (low_passed >= ptr->aging && ptr->low_queue.dequeue(task)) {
+      low_passed = 0;
+      return true;
+   }
+   if (normal_passed >= ptr->aging && next_normal(task)) {
+      normal_passed = 0;
+      return true;
+   }
+
+   if (ptr->high_queue.dequeue(task)) {
+      normal_passed += ptr->any_normal_job() ? 1 : 0;
+      low_passed += ptr->low_queue.empty() ? 0 : 1;
+      return true;
+   }
+   if (next_normal(task)) {
+      normal_passed = 0;
+      low_passed += ptr->low_queue.empty() ? 0 : 1;
+      return true;
+   }
+   if (ptr->low_queue.dequeue(task)) {
+      low_passed = 0;
+      return true;
+   }
+
+   return false;
+}
+
+/*
+ * Gets next Normal job to run. In work-stealing, lock-free and NUMA modes the local deque
+ * with the nested submits of the worker is served first, then the queues which hold jobs
+ * submitted from outside of the pool and finally the jobs are stolen from other workers.
+ * In lock-free mode the ring queue is served before its overflow in the global queue.
+ */
+bool ThreadPool::ThreadWorker::next_normal(Task & task)
+{
+   Task * job;
+
+   switch (ptr->scheduling) {
+      case Scheduling::Global:
+         return ptr->job_queue.dequeue(task);
+      case Scheduling::Deadline:
+         // jobs without a deadline run when no deadline job waits
+         return next_deadline(task) || ptr->job_queue.dequeue(task);
+      default:
+         break;
+   }
+
+   if (ptr->worker_queues[index]->pop(job)) {
+      ptr->unwrap(job, task);
+      return true;
+   }
+
+   switch (ptr->scheduling) {
+      case Scheduling::LockFree:
+         if (ptr->ring_queue->dequeue(task) || ptr->job_queue.dequeue(task)) {
+            return true;
+         }
+         break;
+      case Scheduling::Numa:
+         // local node first, then the remote ones
+         for (std::size_t i = 0; i < ptr->node_queues.size(); i++) {
+            auto &q = *ptr->node_queues[(index + i) % ptr->node_queues.size()];
+            if (q.ring.dequeue(task) || q.overflow.dequeue(task)) {
+               return true;
+            }
+         }
+         break;
+      default:
+         if (ptr->job_queue.dequeue(task)) {
+            return true;
+         }
+         break;
+   }
+
+   if (steal_job(job)) {
+      ptr->unwrap(job, task);
+      return true;
+   }
+
+   return false;
+}
+
+/*
+ * Gets a job for a worker waiting for a future. The waited for subtask is most likely the
+ * newest job, so a helper takes the global queue from the back, as the workers with
+ * deques do with their own ones, while idle workers take the oldest and biggest jobs.
+ * Going depth first keeps the nesting of waiting jobs close to the recursion depth.
+ */
+bool ThreadPool::ThreadWorker::next_help(Task & task)
+{
+   if (!ptr->prioritized.load(std::memory_order_relaxed)) {
+      switch (ptr->scheduling) {
+         case Scheduling::Global:
+            return ptr->job_queue.dequeue_last(task);
+         case Scheduling::Deadline:
+            return next_deadline(task) || ptr->job_queue.dequeue_last(task);
+         default:
+            break;
+      }
+   }
+
+   return next_job(task);
+}
+
+/*
+ * Gets the job with the earliest deadline. With drop_expired set the jobs which are
+ * already late are dropped here, so they never delay the jobs which still can make it.
+ */
+bool ThreadPool::ThreadWorker::next_deadline(Task & task)
+{
+   WorkerState & state = ptr->worker_state[index];
+   DeadlineJob job;
+
+   while (ptr->deadline_queue->pop(job, deadline)) {
+      if (ptr->drop_expired && deadline < std::chrono::steady_clock::now()) {
+         if (job.state != nullptr) {
+            job.state->cancel();
+         }
+         job.task.reset();
+         state.dropped.store(state.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+         state.missed.store(state.missed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+         ptr->finish();
+         continue;
+      }
+
+      task = std::move(job.task);
+      timed = true;
+      return true;
+   }
+
+   return false;
+}
+
+/*
+ * Steals a job from a random victim.
+ */
+bool ThreadPool::ThreadWorker::steal_job(Task * & job)
+{
+   const std::size_t n = ptr->used_slots.load(std::memory_order_acquire);
+   if (n < 2) {
+      return false;
+   }
+
+   // a few random victims first, then a full scan so no job is missed before parking
+   for (std::size_t i = 0; i < n; i++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      std::size_t victim = static_cast<std::size_t>(seed % n);
+      if (victim != index && ptr->worker_queues[victim]->steal(job)) {
+         return true;
+      }
+   }
+   for (std::size_t victim = 0; victim < n; victim++) {
+      if (victim != index && ptr->worker_queues[victim]->steal(job)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/*
+ * Default ThreadPool ctor.
+ */
+ThreadPool::ThreadPool(const std::size_t threads_num, Scheduling mode)
+   : scheduling(mode),
+     min_threads(threads_num > 0 ? threads_num : std::thread::hardware_concurrency()),
+     max_threads(min_threads),
+     target_threads(min_threads)
+{
+   allocate_workers();
+
+   if (scheduling == Scheduling::LockFree) {
+      ring_queue.reset(new LockFreeQueue<Task>(ring_capacity));
+   }
+   if (scheduling == Scheduling::Deadline) {
+      deadline_queue.reset(new DeadlineQueue<DeadlineJob>(min_threads));
+   }
+   if (scheduling == Scheduling::Numa) {
+      Topology topology;
+      const auto &nodes = topology.nodes();
+
+      for (auto node : nodes) {
+         // no need for node memory on a single node machine
+         node_queues.emplace_back(new NodeQueue(nodes.size() > 1 ? node : -1, topology.node_cpus(node)));
+      }
+      if (node_queues.empty()) {
+         node_queues.emplace_back(new NodeQueue(-1, std::vector<int>()));
+      }
+      for (auto &c : topology.cpus()) {
+         if (cpu_node.size() <= static_cast<std::size_t>(c.id)) {
+            cpu_node.resize(c.id + 1, -1);
+         }
+         cpu_node[c.id] = static_cast<int>(std::find(nodes.begin(), nodes.end(), c.node) - nodes.begin());
+      }
+   }
+};
+
+/*
+ * Worker slots are allocated for the maximum size and the spare workers of blocking
+ * sections up front, so thieves and the queue scans never see the slots array change
+ * while the pool is running. Deques of the spare slots are created when the slots are
+ * used first, see spawn_workers().
+ */
+void ThreadPool::allocate_workers()
+{
+   const std::size_t slots = max_threads + spare_threads;
+
+   threads = std::vector<std::thread>(slots);
+   worker_state.reset(new WorkerState[slots]);
+   cpu_map.assign(slots, -1);
+   used_slots = 0;
+
+   worker_queues.clear();
+   if (scheduling == Scheduling::WorkStealing || scheduling == Scheduling::LockFree || scheduling == Scheduling::Numa) {
+      worker_queues.resize(slots);
+      for (std::size_t i = 0; i < max_threads; i++) {
+         worker_queues[i].reset(new WorkStealingDeque<Task*>());
+      }
+   }
+}
+
+/*
+ * ThreadPool dtor, releases all jobs which were not executed.
+ */
+ThreadPool::~ThreadPool()
+{
+   Task * job;
+
+   {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      timer_stop = true;
+   }
+   timercv.notify_all();
+   if (timer_thread.joinable()) {
+      timer_thread.join();
+   }
+
+   shutdown();
+
+   for (auto &q : worker_queues) {
+      while (q && q->pop(job)) {
+         delete job;
+      }
+   }
+   drain();
+
+   // fibers still blocked at this point are abandoned, their stack frames are not unwound
+   for (auto f : fiber_all) {
+      FiberScheduler::destroy(f);
+   }
+};
+
+/*
+ * Destroying a job breaks the promise of its future, which can schedule a continuation,
+ * so the queues are emptied while the pool is intact and such continuations are dropped.
+ */
+void ThreadPool::drain()
+{
+   Task task;
+   DeadlineJob job;
+   std::chrono::steady_clock::time_point deadline;
+
+   while (high_queue.dequeue(task) || job_queue.dequeue(task) || low_queue.dequeue(task)) {
+      task.reset();
+   }
+   while (ring_queue && ring_queue->dequeue(task)) {
+      task.reset();
+   }
+   while (deadline_queue && deadline_queue->pop(job, deadline)) {
+      job.task.reset();
+   }
+   for (auto &q : node_queues) {
+      while (q->ring.dequeue(task) || q->overflow.dequeue(task)) {
+         task.reset();
+      }
+   }
+   timer_wheel.reset();
+}
+
+/*
+ * Continuations run on the thread completing the future, usually a worker, so they go
+ * to its deque in the WorkStealing mode.
+ */
+void ThreadPool::schedule(Task & task)
+{
+   if (shut_flag.load(std::memory_order_acquire)) {
+      task.reset();
+      return;
+   }
+   enqueue(task);
+}
+
+/*
+ *
+ */
+void ThreadPool::enqueue(Task & task)
+{
+   const bool nested = worker_pool == this && !worker_queues.empty();
+
+   if (scheduling == Scheduling::Numa && !nested) {
+      enqueue_on_node(current_node(), task);
+      return;
+   }
+
+   outstanding.fetch_add(1);
+
+   if (nested) {
+      // nested submit goes to the submitting worker deque
+      worker_queues[worker_index]->push(wrap(task));
+   } else if (scheduling == Scheduling::LockFree) {
+      if (!ring_queue->try_enqueue(std::move(task))) {
+         // ring is full, so do not block the submitter
+         job_queue.enqueue(std::move(task));
+      }
+   } else {
+      job_queue.enqueue(std::move(task));
+   }
+
+   wakeup(1);
+}
+
+/*
+ * The deque holds pointers, as thieves read its slots while the owner writes them. A
+ * wrapper goes back to the worker which took the job out, so a worker running its own
+ * subtasks allocates no wrappers after warming up.
+ */
+Task * ThreadPool::wrap(Task & task)
+{
+   auto &spare = worker_state[worker_index].free_tasks;
+
+   if (spare.empty()) {
+      return new Task(std::move(task));
+   }
+
+   Task * job = spare.back().release();
+   spare.pop_back();
+   *job = std::move(task);
+   return job;
+}
+
+/*
+ *
+ */
+void ThreadPool::unwrap(Task * job, Task & task)
+{
+   auto &spare = worker_state[worker_index].free_tasks;
+
+   task = std::move(*job);
+   if (spare.size() < max_free_tasks) {
+      spare.emplace_back(job);
+   } else {
+      delete job;
+   }
+}
+
+/*
+ * Bulk version of enqueue, the whole group is moved to the queue with a single lock or
+ * a single ring reservation.
+ */
+void ThreadPool::enqueue(std::vector<Task> & tasks)
+{
+   std::size_t done = 0;
+
+   if (tasks.empty()) {
+      return;
+   }
+   outstanding.fetch_add(tasks.size());
+
+   if (worker_pool == this && !worker_queues.empty()) {
+      for (auto &task : tasks) {
+         worker_queues[worker_index]->push(wrap(task));
+      }
+      wakeup(tasks.size());
+      return;
+   }
+
+   switch (scheduling) {
+      case Scheduling::LockFree:
+         done = ring_queue->try_enqueue_bulk(tasks.begin(), tasks.size());
+         break;
+      case Scheduling::Numa: {
+         auto &q = *node_queues[current_node()];
+         done = q.ring.try_enqueue_bulk(tasks.begin(), tasks.size());
+         q.overflow.enqueue(tasks.begin() + done, tasks.end());
+         done = tasks.size();
+         break;
+      }
+      default:
+         break;
+   }
+
+   if (done < tasks.size()) {
+      job_queue.enqueue(tasks.begin() + done, tasks.end());
+   }
+
+   wakeup(tasks.size());
+}
+
+/*
+ * Normal jobs use the queues of the scheduling mode, the other levels have their own queues.
+ */
+void ThreadPool::enqueue(Priority priority, Task & task)
+{
+   if (priority == Priority::Normal) {
+      enqueue(task);
+      return;
+   }
+
+   if (!prioritized.load(std::memory_order_relaxed)) {
+      prioritized = true;
+   }
+   outstanding.fetch_add(1);
+   if (priority == Priority::High) {
+      high_queue.enqueue(std::move(task));
+   } else {
+      low_queue.enqueue(std::move(task));
+   }
+
+   wakeup(1);
+}
+
+/*
+ * Workers push to their own heap shard, other threads to the shard of their thread id.
+ */
+void ThreadPool::enqueue(std::chrono::steady_clock::time_point deadline, Task & task, FutureStateBase * state)
+{
+   if (scheduling != Scheduling::Deadline) {
+      enqueue(task);
+      return;
+   }
+
+   const std::size_t hint = worker_pool == this ? worker_index : std::hash<std::thread::id>()(std::this_thread::get_id());
+   outstanding.fetch_add(1);
+   deadline_queue->push(hint, deadline, DeadlineJob { std::move(task), state });
+
+   wakeup(1);
+}
+
+/*
+ *
+ */
+void ThreadPool::enqueue_on_node(std::size_t node, Task & task)
+{
+   if (scheduling != Scheduling::Numa) {
+      enqueue(task);
+      return;
+   }
+
+   outstanding.fetch_add(1);
+   auto &q = *node_queues[node % node_queues.size()];
+   if (!q.ring.try_enqueue(std::move(task))) {
+      // ring is full, so do not block the submitter
+      q.overflow.enqueue(std::move(task));
+   }
+
+   wakeup(1);
+}
+
+/*
+ * Workers use the node they are bound to, other threads the node of the CPU they run on.
+ */
+std::size_t ThreadPool::current_node()
+{
+   if (worker_pool == this) {
+      return worker_index % node_queues.size();
+   }
+
+#if defined __linux__
+   int cpu = sched_getcpu();
+   if (cpu >= 0 && static_cast<std::size_t>(cpu) < cpu_node.size() && cpu_node[cpu] >= 0) {
+      return static_cast<std::size_t>(cpu_node[cpu]);
+   }
+#endif
+
+   return 0;
+}
+
+/*
+ * Notifies parked workers only, spinning and running workers find the jobs by themselves.
+ */
+void ThreadPool::wakeup(std::size_t n)
+{
+   // pairs with the fence in has_job() so a parking worker cannot miss the job
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   std::size_t sleeping = sleeping_threads;
+   if (sleeping > 0) {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+      }
+      if (n >= sleeping) {
+         waitcv.notify_all();
+      } else {
+         for (; n > 0; n--) {
+            waitcv.notify_one();
+         }
+      }
+   }
+}
+
+/*
+ * Tasks created by submit() store exceptions in their futures, so only posted
+ * functions can throw here.
+ */
+void ThreadPool::execute(Task & task)
+{
+   try {
+      task();
+   } catch (...) {
+      std::function<void(std::exception_ptr)> handler;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         handler = exception_handler;
+      }
+      if (handler) {
+         handler(std::current_exception());
+      } else {
+         try {
+            throw;
+         } catch (const std::exception &e) {
+            std::cerr << "ThreadPool: unhandled exception in posted job: " << e.what() << std::endl;
+         } catch (...) {
+            std::cerr << "ThreadPool: unhandled exception in posted job" << std::endl;
+         }
+      }
+   }
+
+   task.reset();
+}
+
+/*
+ * The counter decrement and the waiters check are both sequentially consistent, so either
+ * wait_idle() sees the zero counter or finish() sees the registered waiter. Notification
+ * under the mutex cannot be lost between the check and the wait in wait_idle().
+ */
+void ThreadPool::finish()
+{
+   if (outstanding.fetch_sub(1) == 1 && idle_waiters.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      idlecv.notify_all();
+   }
+}
+
+/*
+ *
+ */
+void ThreadPool::wait_idle()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+
+   idle_waiters++;
+   idlecv.wait(lock, [this]{ return outstanding.load() == 0; });
+   idle_waiters--;
+}
+
+/*
+ *
+ */
+bool ThreadPool::wait_idle_until(const std::chrono::steady_clock::time_point & deadline)
+{
+   std::unique_lock<std::mutex> lock(mutex);
+
+   idle_waiters++;
+   bool idle = idlecv.wait_until(lock, deadline, [this]{ return outstanding.load() == 0; });
+   idle_waiters--;
+
+   return idle;
+}
+
+/*
+ *
+ */
+void ThreadPool::set_wait_policy(WaitPolicy policy, std::size_t spins)
+{
+   wait_policy = policy;
+   spin_count = spins > 0 ? spins : 1;
+}
+
+/*
+ *
+ */
+void ThreadPool::set_priority_aging(std::size_t jobs)
+{
+   aging = jobs > 0 ? jobs : 1;
+}
+
+/*
+ *
+ */
+void ThreadPool::set_drop_expired(bool drop)
+{
+   drop_expired = drop;
+}
+
+/*
+ *
+ */
+void ThreadPool::set_fibers(std::size_t stack_size)
+{
+   if (!FiberScheduler::supported()) {
+      throw std::logic_error("fibers are not supported on this platform");
+   }
+   fiber_stack = std::max<std::size_t>(stack_size, 16 * 1024);
+}
+
+/*
+ *
+ */
+void ThreadPool::resume_fiber(Fiber * fiber)
+{
+   ready_fibers.enqueue(fiber);
+   wakeup(1);
+}
+
+/*
+ * Workers of other pools and threads outside of pools just wait.
+ */
+void ThreadPool::help(FutureStateBase & state)
+{
+   if (worker_pool == this && worker_state[worker_index].worker != nullptr) {
+      worker_state[worker_index].worker->help(state);
+   } else {
+      state.wait();
+   }
+}
+
+/*
+ *
+ */
+void ThreadPool::set_exception_handler(std::function<void(std::exception_ptr)> handler)
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   exception_handler = std::move(handler);
+}
+
+/*
+ *
+ */
+bool ThreadPool::has_job()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+
+   return any_job();
+}
+
+/*
+ *
+ */
+bool ThreadPool::any_job()
+{
+   return any_normal_job() || !high_queue.empty() || !low_queue.empty() || !ready_fibers.empty();
+}
+
+/*
+ *
+ */
+bool ThreadPool::any_normal_job()
+{
+   if (ring_queue && !ring_queue->empty()) {
+      return true;
+   }
+
+   if (deadline_queue && !deadline_queue->empty()) {
+      return true;
+   }
+
+   const std::size_t slots = worker_queues.empty() ? 0 : used_slots.load(std::memory_order_acquire);
+   for (std::size_t i = 0; i < slots; i++) {
+      if (!worker_queues[i]->empty()) {
+         return true;
+      }
+   }
+
+   for (auto &q : node_queues) {
+      if (!q->ring.empty() || !q->overflow.empty()) {
+         return true;
+      }
+   }
+
+   return !job_queue.empty();
+}
+
+/*
+ * Counters are summed on read, so the workers never share a cache line on the hot path.
+ */
+std::size_t ThreadPool::num_available()
+{
+   std::size_t n = 0;
+
+   for (std::size_t i = 0; i < threads.size(); i++) {
+      n += worker_state[i].available ? 1 : 0;
+   }
+
+   return n;
+}
+
 /*
  *
  */
-ThreadPool::ThreadWorker::ThreadWorker(ThreadPool * pool) : ptr(pool) {};
+std::size_t ThreadPool::num_running()
+{
+   std::size_t n = 0;
+
+   for (std::size_t i = 0; i < threads.size(); i++) {
+      n += worker_state[i].running ? 1 : 0;
+   }
+
+   return n;
+}
 
 /*
  *
  */
-void ThreadPool::ThreadWorker::operator()()
+std::size_t ThreadPool::deadlines_met()
 {
-   std::function<void()> func;
-   bool dequeued;
+   std::size_t n = 0;
 
-   // signal thread avaliability
-   ptr->available_threads++;
+   for (std::size_t i = 0; i < threads.size(); i++) {
+      n += worker_state[i].met;
+   }
 
-   while (!ptr->shut_flag)
-   {
-      ThreadPool * poolptr = ptr;      // a little local helper
-      {
-         std::unique_lock<std::mutex> lock(ptr->mutex);
+   return n;
+}
 
-         // wait on new task to execute or shutdown notification
-         ptr->waitcv.wait(lock, [this, poolptr]
-            {
-               return !poolptr->job_queue.empty() || poolptr->shut_flag;
-            });
+/*
+ *
+ */
+std::size_t ThreadPool::deadlines_missed()
+{
+   std::size_t n = 0;
 
-         // signal work start
-         ptr->running_threads++;
-         // get next task to complete
-         dequeued = !ptr->shut_flag ? ptr->job_queue.dequeue(func) : false;
-      }
+   for (std::size_t i = 0; i < threads.size(); i++) {
+      n += worker_state[i].missed;
+   }
 
-      // got new task to run
-      if (dequeued) {
-         func();
-      }
+   return n;
+}
+
+/*
+ *
+ */
+std::size_t ThreadPool::deadlines_dropped()
+{
+   std::size_t n = 0;
 
-      // signal work done
-      ptr->running_threads--;
+   for (std::size_t i = 0; i < threads.size(); i++) {
+      n += worker_state[i].dropped;
    }
 
-   // signal thread exit
-   ptr->available_threads--;
-};
+   return n;
+}
 
 /*
- * Default ThreadPool ctor.
+ *
+ */
+std::size_t ThreadPool::queue_size()
+{
+   return normal_size() + high_queue.size() + low_queue.size();
+}
+
+/*
+ *
+ */
+std::size_t ThreadPool::queue_size(Priority priority)
+{
+   switch (priority) {
+      case Priority::High:
+         return high_queue.size();
+      case Priority::Low:
+         return low_queue.size();
+      default:
+         return normal_size();
+   }
+}
+
+/*
+ *
  */
-ThreadPool::ThreadPool(const std::size_t threads_num)
-   : threads(std::vector<std::thread>(threads_num > 0 ? threads_num : std::thread::hardware_concurrency())) {};
+std::size_t ThreadPool::normal_size()
+{
+   std::size_t size = job_queue.size();
+
+   if (ring_queue) {
+      size += ring_queue->size();
+   }
+
+   if (deadline_queue) {
+      size += deadline_queue->size();
+   }
+
+   const std::size_t slots = worker_queues.empty() ? 0 : used_slots.load(std::memory_order_acquire);
+   for (std::size_t i = 0; i < slots; i++) {
+      size += worker_queues[i]->size();
+   }
+
+   for (auto &q : node_queues) {
+      size += q->ring.size() + q->overflow.size();
+   }
+
+   return size;
+}
 
 /*
  *
  */
 void ThreadPool::init(bool cpuaffinity)
 {
+   init(cpuaffinity ? Affinity::Naive : Affinity::None);
+}
+
+/*
+ * Computes the CPU of every worker slot, so workers started later by resize() or by
+ * the elastic growth are bound the same way as the initial ones.
+ */
+void ThreadPool::init(Affinity policy)
+{
+   std::lock_guard<std::mutex> lock(resize_mutex);
+   bool placed = false;
+
+   if (started) {
+      return;
+   }
+
    shut_flag = false;
+   affinity = policy;
+   cpu_map.assign(threads.size(), -1);
 
-#if defined __sun__ || defined __linux__ || defined __APPLE__
-   if (cpuaffinity){
-      // create threads and assign them to different cores
-      std::size_t vcpu = 0;
-      std::size_t vcpu_max = std::thread::hardware_concurrency() - 1;
+#if defined __linux__
+   if (scheduling == Scheduling::Numa) {
+      // every worker is bound to all cpus of its node, the map shows the first of them
+      for (std::size_t i = 0; i < threads.size(); i++) {
+         auto &cpus = node_queues[i % node_queues.size()]->cpus;
+         cpu_map[i] = cpus.empty() ? -1 : cpus.front();
+      }
+      placed = true;
+   } else if (affinity == Affinity::Spread || affinity == Affinity::Pack) {
+      // place threads on distinct physical cores of the allowed cpuset first
+      Topology topology;
+      std::vector<int> cpus = topology.placement(affinity == Affinity::Spread ?
+                                                 Topology::Placement::Spread : Topology::Placement::Pack);
+      if (!cpus.empty()) {
+         for (std::size_t i = 0; i < threads.size(); i++) {
+            cpu_map[i] = cpus[i % cpus.size()];
+         }
+         placed = true;
+      }
+   }
+#endif
 
+   if (!placed && affinity != Affinity::None) {
+      // assign threads to different cores
 #if defined __sun__
       std::vector<processorid_t> vcpuid;   /* Struct for CPU/core ID */
 
@@ -135,47 +1154,363 @@ void ThreadPool::init(bool cpuaffinity)
             vcpuid.push_back(i);
          }
       }
+      for (std::size_t n = 0; n < threads.size() && !vcpuid.empty(); n++) {
+         cpu_map[n] = vcpuid[n % vcpuid.size()];
+      }
+#elif defined __linux__
+      for (std::size_t i = 0; i < threads.size(); i++) {
+         cpu_map[i] = static_cast<int>(i % std::thread::hardware_concurrency());
+      }
 #endif
+   }
 
-      for (auto &t : threads) {
+   started = true;
+   spawn_workers();
+
+   if (min_threads < max_threads) {
+      supervisor = std::thread(&ThreadPool::supervise, this);
+   }
+}
 
+/*
+ *
+ */
+void ThreadPool::start_worker(std::size_t index)
+{
 #if defined __sun__
-      processor_bind(P_LWPID, P_MYID, vcpuid[vcpu], NULL);
+   if (cpu_map[index] >= 0) {
+      processor_bind(P_LWPID, P_MYID, cpu_map[index], NULL);
+   }
 #endif
 
-         // get thread reference and spawn a working thread using ThreadWorker class
-         t = std::thread(ThreadWorker(this));
+   // get thread reference and spawn a working thread using ThreadWorker class
+   auto &t = threads[index];
+   t = std::thread(ThreadWorker(this, index));
 
 #if defined __linux__
+   if (scheduling == Scheduling::Numa) {
+      auto &cpus = node_queues[index % node_queues.size()]->cpus;
+
+      if (!cpus.empty()) {
          cpu_set_t mask;
          CPU_ZERO(&mask);
-         CPU_SET(vcpu, &mask);
+         for (auto cpu : cpus) {
+            CPU_SET(cpu, &mask);
+         }
          pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &mask);
+      }
+   } else if (cpu_map[index] >= 0) {
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpu_map[index], &mask);
+      pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &mask);
+   }
 #endif
 
 #if defined __APPLE__
-         thread_affinity_policy_data_t policy = { static_cast<integer_t>(vcpu) };
-         thread_policy_set(pthread_mach_thread_np(t.native_handle()),
-                           THREAD_AFFINITY_POLICY,
-                           (thread_policy_t)&policy,
-                           THREAD_AFFINITY_POLICY_COUNT);
+   if (affinity != Affinity::None) {
+      thread_affinity_policy_data_t policy = { static_cast<integer_t>(index % std::thread::hardware_concurrency()) };
+      thread_policy_set(pthread_mach_thread_np(t.native_handle()),
+                        THREAD_AFFINITY_POLICY,
+                        (thread_policy_t)&policy,
+                        THREAD_AFFINITY_POLICY_COUNT);
+   }
 #endif
+}
+
+/*
+ * Called with resize_mutex held. A retiring worker leaves its slot right after it is
+ * accounted, so a short wait for a free slot is enough. The deque of a slot is published
+ * by raising used_slots before its worker starts, thieves and scans look below it only.
+ */
+void ThreadPool::spawn_workers()
+{
+   while (started && live_threads < target_threads + compensating) {
+      bool spawned = false;
 
-         // handle cpu max index
-         if (++vcpu > vcpu_max) {
-            vcpu = 0;
+      for (std::size_t i = 0; i < threads.size(); i++) {
+         if (!worker_state[i].active) {
+            if (threads[i].joinable()) {
+               threads[i].join();
+            }
+            if (!worker_queues.empty() && !worker_queues[i]) {
+               worker_queues[i].reset(new WorkStealingDeque<Task*>());
+            }
+            if (i >= used_slots) {
+               used_slots.store(i + 1, std::memory_order_release);
+            }
+            worker_state[i].active = true;
+            live_threads++;
+            start_worker(i);
+            spawned = true;
+            break;
          }
       }
-   } else {
-#endif
-      // simple thread creation
-      for (auto &t : threads) {
-         // get thread reference and spawn a working thread using ThreadWorker class
-         t = std::thread(ThreadWorker(this));
+
+      if (!spawned) {
+         std::this_thread::yield();
       }
-#if defined __sun__ || defined __linux__ || defined __APPLE__
    }
-#endif
+}
+
+/*
+ * A worker retires between jobs only, and in the modes with deques with its deque empty,
+ * so neither running nor queued jobs are affected.
+ */
+bool ThreadPool::retire(std::size_t index)
+{
+   std::size_t live = live_threads;
+
+   while (live > target_threads) {
+      if (!worker_queues.empty() && !worker_queues[index]->empty()) {
+         return false;
+      }
+      if (live_threads.compare_exchange_weak(live, live - 1)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/*
+ *
+ */
+void ThreadPool::expire()
+{
+   std::size_t target = target_threads;
+
+   while (target > min_threads && !target_threads.compare_exchange_weak(target, target - 1)) {
+   }
+}
+
+/*
+ * A parked worker takes over the jobs while the caller blocks, so an extra worker is
+ * started only when none is parked. shutdown() holds the resize mutex while it joins the
+ * workers, so a worker does not wait for the mutex once the pool is shutting down.
+ */
+bool ThreadPool::compensate()
+{
+   std::unique_lock<std::mutex> lock(resize_mutex, std::defer_lock);
+
+   if (worker_pool != this || sleeping_threads > 0) {
+      return false;
+   }
+
+   while (!lock.try_lock()) {
+      if (shut_flag) {
+         return false;
+      }
+      std::this_thread::yield();
+   }
+
+   if (!started || compensating >= spare_threads) {
+      return false;
+   }
+
+   compensating++;
+   spawn_workers();
+   return true;
+}
+
+/*
+ * Any worker may retire, the first one which finds the pool in surplus between jobs.
+ */
+void ThreadPool::decompensate()
+{
+   compensating--;
+
+   if (surplus()) {
+      std::lock_guard<std::mutex> lock(mutex);
+      waitcv.notify_all();
+   }
+}
+
+/*
+ * Jobs are considered waiting too long when the queues stay non-empty with no parked
+ * worker for the grow_wait time. A deep queue starts a new worker at once. At most one
+ * worker is added per check, so a short burst does not inflate the pool to the maximum.
+ */
+void ThreadPool::supervise()
+{
+   const auto tick = std::max(grow_wait / 2, std::chrono::milliseconds(1));
+   auto since = std::chrono::steady_clock::now();
+   std::unique_lock<std::mutex> lock(resize_mutex);
+
+   while (started) {
+      supervisorcv.wait_for(lock, tick);
+      if (!started) {
+         break;
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      const std::size_t backlog = queue_size();
+      if (backlog == 0 || sleeping_threads > 0) {
+         since = now;
+         continue;
+      }
+
+      if ((backlog >= grow_depth || now - since >= grow_wait) && target_threads < max_threads) {
+         target_threads++;
+         spawn_workers();
+         since = now;
+      }
+   }
+}
+
+/*
+ *
+ */
+void ThreadPool::start_timers()
+{
+   if (!timer_wheel) {
+      timer_wheel.reset(new TimerWheel());
+      timer_wake = std::chrono::steady_clock::time_point::max();
+      timer_thread = std::thread(&ThreadPool::run_timers, this);
+   }
+}
+
+/*
+ * The timer thread is notified only when the new timer expires before its planned wakeup.
+ */
+ThreadPool::TimerId ThreadPool::add_timer(std::chrono::steady_clock::time_point when, Task & task)
+{
+   std::lock_guard<std::mutex> lock(timer_mutex);
+
+   start_timers();
+   TimerId id = timer_wheel->add(when, std::move(task));
+   if (when < timer_wake) {
+      timercv.notify_one();
+   }
+
+   return id;
+}
+
+/*
+ *
+ */
+ThreadPool::TimerId ThreadPool::add_timer(std::chrono::steady_clock::time_point when, std::chrono::steady_clock::duration period,
+                                          std::shared_ptr<std::function<void()>> func)
+{
+   std::lock_guard<std::mutex> lock(timer_mutex);
+
+   start_timers();
+   TimerId id = timer_wheel->add(when, period, std::move(func));
+   if (when < timer_wake) {
+      timercv.notify_one();
+   }
+
+   return id;
+}
+
+/*
+ *
+ */
+bool ThreadPool::cancel_timer(TimerId id)
+{
+   std::lock_guard<std::mutex> lock(timer_mutex);
+
+   return timer_wheel && timer_wheel->cancel(id);
+}
+
+/*
+ *
+ */
+std::size_t ThreadPool::num_timers()
+{
+   std::lock_guard<std::mutex> lock(timer_mutex);
+
+   return timer_wheel ? timer_wheel->size() : 0;
+}
+
+/*
+ * All timers expired at once are released with a single bulk enqueue, so a single queue
+ * operation and wakeup, outside of the timer lock.
+ */
+void ThreadPool::run_timers()
+{
+   std::vector<Task> expired;
+   std::unique_lock<std::mutex> lock(timer_mutex);
+
+   while (!timer_stop) {
+      timer_wheel->advance(std::chrono::steady_clock::now(), expired);
+      if (!expired.empty()) {
+         lock.unlock();
+         enqueue(expired);
+         expired.clear();
+         lock.lock();
+         continue;
+      }
+
+      timer_wake = timer_wheel->next_expiry();
+      if (timer_wake == std::chrono::steady_clock::time_point::max()) {
+         timercv.wait(lock);
+      } else {
+         timercv.wait_until(lock, timer_wake);
+      }
+   }
+}
+
+/*
+ *
+ */
+void ThreadPool::set_limits(std::size_t min, std::size_t max, std::chrono::milliseconds idle_time)
+{
+   std::lock_guard<std::mutex> lock(resize_mutex);
+
+   if (started) {
+      return;
+   }
+
+   min_threads = min > 0 ? min : 1;
+   max_threads = std::max(min_threads, max);
+   keep_alive = idle_time;
+   target_threads = std::min(std::max<std::size_t>(target_threads, min_threads), max_threads);
+   allocate_workers();
+}
+
+/*
+ *
+ */
+void ThreadPool::set_compensation(std::size_t spare)
+{
+   std::lock_guard<std::mutex> lock(resize_mutex);
+
+   if (started) {
+      return;
+   }
+
+   spare_threads = spare;
+   allocate_workers();
+}
+
+/*
+ *
+ */
+void ThreadPool::set_growth(std::size_t queue_depth, std::chrono::milliseconds wait_time)
+{
+   std::lock_guard<std::mutex> lock(resize_mutex);
+
+   grow_depth = queue_depth > 0 ? queue_depth : 1;
+   grow_wait = wait_time;
+}
+
+/*
+ * Growing starts the new workers before it returns. Shrinking only lowers the target,
+ * the surplus workers retire when they finish their current jobs, parked ones are woken
+ * up to do so.
+ */
+void ThreadPool::resize(std::size_t n)
+{
+   std::lock_guard<std::mutex> lock(resize_mutex);
+
+   target_threads = std::min(std::max<std::size_t>(n, 1), max_threads);
+   spawn_workers();
+
+   if (surplus()) {
+      std::lock_guard<std::mutex> lock(mutex);
+      waitcv.notify_all();
+   }
 }
 
 /*
@@ -183,8 +1518,23 @@ void ThreadPool::init(bool cpuaffinity)
  */
 void ThreadPool::shutdown(bool abort)
 {
-   // flag shutdown state
-   shut_flag = true;
+   // stop the elastic growth first, it could start new workers
+   {
+      std::lock_guard<std::mutex> lock(resize_mutex);
+      started = false;
+   }
+   supervisorcv.notify_all();
+   if (supervisor.joinable()) {
+      supervisor.join();
+   }
+
+   std::lock_guard<std::mutex> lock(resize_mutex);
+
+   // flag shutdown state, under the lock so no parking worker can miss it
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      shut_flag = true;
+   }
 
    // iterate through all running threads in the pool
    for (auto &t: threads) {
@@ -201,4 +1551,5 @@ void ThreadPool::shutdown(bool abort)
          t.join();
       }
    }
+   live_threads = 0;
 }
@@ -0,0 +1,291 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   TimerWheel.cpp
+ *
+ * Hierarchical timing wheel used for delayed and periodic jobs of the ThreadPool.
+ */
+
+#include <algorithm>
+#include "TimerWheel.h"
+
+constexpr TimerWheel::Id TimerWheel::invalid;
+constexpr unsigned TimerWheel::levels;
+constexpr unsigned TimerWheel::bits;
+constexpr std::size_t TimerWheel::slots;
+constexpr std::int32_t TimerWheel::none;
+
+/*
+ *
+ */
+TimerWheel::TimerWheel(Clock::duration res, Clock::time_point origin)
+   : start(origin), resolution(res > Clock::duration::zero() ? res : Clock::duration(1))
+{
+   for (auto &level : heads) {
+      std::fill(std::begin(level), std::end(level), none);
+   }
+}
+
+/*
+ *
+ */
+std::int32_t TimerWheel::allocate()
+{
+   if (free_list != none) {
+      std::int32_t i = free_list;
+      free_list = nodes[i].next;
+      return i;
+   }
+
+   nodes.emplace_back();
+   return static_cast<std::int32_t>(nodes.size() - 1);
+}
+
+/*
+ * Bumps the node generation, so ids of the released timer are not valid anymore.
+ */
+void TimerWheel::release(std::int32_t i)
+{
+   Node & n = nodes[i];
+
+   n.level = -1;
+   n.gen++;
+   n.task.reset();
+   n.func.reset();
+   n.next = free_list;
+   free_list = i;
+}
+
+/*
+ * Timers expiring in the next 256 ticks go to level 0, then every level holds 256 times
+ * longer range. A timer beyond the last level is put into its farthest slot and cascaded
+ * again when it comes.
+ */
+void TimerWheel::link(std::int32_t i)
+{
+   Node & n = nodes[i];
+   std::uint64_t delta = n.expires > current ? n.expires - current : 0;
+   std::uint64_t e = n.expires;
+   unsigned level = 0;
+
+   while (level < levels - 1 && delta >= (std::uint64_t(1) << ((level + 1) * bits))) {
+      level++;
+   }
+   if (level == levels - 1 && delta >= (std::uint64_t(1) << (levels * bits))) {
+      e = current + (std::uint64_t(1) << (levels * bits)) - 1;
+   }
+
+   n.level = static_cast<std::int16_t>(level);
+   n.slot = static_cast<std::uint16_t>((e >> (level * bits)) & (slots - 1));
+   n.prev = none;
+   n.next = heads[level][n.slot];
+   if (n.next != none) {
+      nodes[n.next].prev = i;
+   }
+   heads[level][n.slot] = i;
+}
+
+/*
+ *
+ */
+void TimerWheel::unlink(std::int32_t i)
+{
+   Node & n = nodes[i];
+
+   if (n.prev != none) {
+      nodes[n.prev].next = n.next;
+   } else {
+      heads[n.level][n.slot] = n.next;
+   }
+   if (n.next != none) {
+      nodes[n.next].prev = n.prev;
+   }
+}
+
+/*
+ * Takes the whole slot list, the nodes keep their links until they are linked again.
+ */
+std::int32_t TimerWheel::detach(unsigned level, std::size_t slot)
+{
+   std::int32_t head = heads[level][slot];
+
+   heads[level][slot] = none;
+   return head;
+}
+
+/*
+ * Moves timers of a higher level slot to the lower levels.
+ */
+void TimerWheel::cascade(unsigned level, std::size_t slot)
+{
+   std::int32_t i = detach(level, slot);
+
+   while (i != none) {
+      std::int32_t next = nodes[i].next;
+      link(i);
+      i = next;
+   }
+}
+
+/*
+ * Rounds up, so a timer never fires before its time point.
+ */
+std::uint64_t TimerWheel::tick_of(Clock::time_point when) const
+{
+   if (when <= start) {
+      return 0;
+   }
+
+   return static_cast<std::uint64_t>((when - start + resolution - Clock::duration(1)) / resolution);
+}
+
+/*
+ * Rounds down, the last tick already reached at the time point.
+ */
+std::uint64_t TimerWheel::elapsed(Clock::time_point now) const
+{
+   if (now <= start) {
+      return 0;
+   }
+
+   return static_cast<std::uint64_t>((now - start) / resolution);
+}
+
+/*
+ * An empty wheel is not advanced by its owner, so it catches up with the clock before
+ * the first timer is linked, otherwise the timer is placed against a stale tick and the
+ * next advance walks all the ticks missed in between.
+ */
+TimerWheel::Id TimerWheel::insert(std::int32_t i, Clock::time_point when)
+{
+   Node & n = nodes[i];
+
+   if (count == 0) {
+      current = std::max(current, elapsed(Clock::now()));
+   }
+
+   // timers in the past fire on the next tick
+   n.expires = std::max(tick_of(when), current + 1);
+   link(i);
+   count++;
+
+   return (static_cast<Id>(n.gen) << 32) | static_cast<Id>(i + 1);
+}
+
+/*
+ *
+ */
+TimerWheel::Id TimerWheel::add(Clock::time_point when, Task task)
+{
+   std::int32_t i = allocate();
+
+   nodes[i].period = 0;
+   nodes[i].task = std::move(task);
+   return insert(i, when);
+}
+
+/*
+ *
+ */
+TimerWheel::Id TimerWheel::add(Clock::time_point when, Clock::duration period, std::shared_ptr<std::function<void()>> func)
+{
+   std::int32_t i = allocate();
+
+   nodes[i].period = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(period / resolution));
+   nodes[i].func = std::move(func);
+   return insert(i, when);
+}
+
+/*
+ *
+ */
+bool TimerWheel::cancel(Id id)
+{
+   const std::uint64_t index = id & 0xffffffffU;
+
+   if (index == 0 || index > nodes.size()) {
+      return false;
+   }
+
+   std::int32_t i = static_cast<std::int32_t>(index - 1);
+   Node & n = nodes[i];
+   if (n.level < 0 || n.gen != static_cast<std::uint32_t>(id >> 32)) {
+      return false;
+   }
+
+   unlink(i);
+   release(i);
+   count--;
+   return true;
+}
+
+/*
+ * Processes every tick up to now: cascades the higher levels when the lower one wraps
+ * and releases the level 0 slot of the tick. Periodic timers keep their rate, missed
+ * periods are skipped instead of released in a burst.
+ */
+void TimerWheel::advance(Clock::time_point now, std::vector<Task> & expired)
+{
+   const std::uint64_t target = elapsed(now);
+
+   while (current < target) {
+      if (count == 0) {
+         current = target;
+         break;
+      }
+
+      current++;
+      std::size_t index = current & (slots - 1);
+      for (unsigned level = 1; level < levels && index == 0; level++) {
+         index = (current >> (level * bits)) & (slots - 1);
+         cascade(level, index);
+      }
+
+      std::int32_t i = detach(0, current & (slots - 1));
+      while (i != none) {
+         std::int32_t next = nodes[i].next;
+         Node & n = nodes[i];
+
+         if (n.period > 0) {
+            auto func = n.func;
+            expired.emplace_back([func]{ (*func)(); });
+            n.expires += n.period;
+            if (n.expires <= current) {
+               n.expires = current + n.period;
+            }
+            link(i);
+         } else {
+            expired.push_back(std::move(n.task));
+            release(i);
+            count--;
+         }
+
+         i = next;
+      }
+   }
+}
+
+/*
+ * The first used level 0 slot, but not later than the next level 0 wrap, as cascading
+ * then can bring timers from the higher levels.
+ */
+TimerWheel::Clock::time_point TimerWheel::next_expiry() const
+{
+   if (count == 0) {
+      return Clock::time_point::max();
+   }
+
+   std::uint64_t wake = (current | (slots - 1)) + 1;
+   for (std::size_t d = 1; d <= slots; d++) {
+      if (heads[0][(current + d) & (slots - 1)] != none) {
+         wake = std::min<std::uint64_t>(wake, current + d);
+         break;
+      }
+   }
+
+   return start + resolution * static_cast<Clock::rep>(wake);
+}
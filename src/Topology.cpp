@@ -0,0 +1,213 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   Topology.cpp
+ *
+ * CPU topology discovery based on Linux sysfs and the process affinity mask.
+ */
+
+#if defined __linux__
+#include <sched.h>
+#endif
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include "Topology.h"
+
+/*
+ * Reads the first line of the sysfs file, returns empty string when it does not exist.
+ */
+static std::string read_line(const std::string & path)
+{
+   std::ifstream file(path);
+   std::string line;
+
+   if (file) {
+      std::getline(file, line);
+   }
+
+   return line;
+}
+
+/*
+ * Reads an integer from the sysfs file, returns def when it does not exist.
+ */
+static int read_int(const std::string & path, int def)
+{
+   std::string line = read_line(path);
+
+   try {
+      return line.empty() ? def : std::stoi(line);
+   } catch (...) {
+      return def;
+   }
+}
+
+/*
+ * Returns CPUs allowed by the process affinity mask.
+ */
+static std::vector<int> allowed_cpus()
+{
+   std::vector<int> cpus;
+
+#if defined __linux__
+   cpu_set_t mask;
+   CPU_ZERO(&mask);
+   if (sched_getaffinity(0, sizeof(cpu_set_t), &mask) == 0) {
+      for (int i = 0; i < CPU_SETSIZE; i++) {
+         if (CPU_ISSET(i, &mask)) {
+            cpus.push_back(i);
+         }
+      }
+   }
+#endif
+
+   if (cpus.empty()) {
+      for (unsigned i = 0; i < std::thread::hardware_concurrency(); i++) {
+         cpus.push_back(static_cast<int>(i));
+      }
+   }
+
+   return cpus;
+}
+
+/*
+ *
+ */
+std::vector<int> Topology::parse_cpulist(const std::string & list)
+{
+   std::vector<int> cpus;
+   std::stringstream ss(list);
+   std::string range;
+
+   while (std::getline(ss, range, ',')) {
+      try {
+         auto dash = range.find('-');
+         int first = std::stoi(range.substr(0, dash));
+         int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+         for (int i = first; i <= last; i++) {
+            cpus.push_back(i);
+         }
+      } catch (...) {
+         // skip malformed entry
+      }
+   }
+
+   return cpus;
+}
+
+/*
+ *
+ */
+Topology::Topology(const std::string & sysfs, const std::vector<int> & allowed)
+{
+   std::vector<int> cpus = allowed.empty() ? allowed_cpus() : allowed;
+   std::vector<int> online = parse_cpulist(read_line(sysfs + "/cpu/online"));
+   std::map<int, int> cpu_node;
+
+   // map cpus to nodes, a missing node directory means a single node machine
+   for (int node : parse_cpulist(read_line(sysfs + "/node/online"))) {
+      for (int cpu : parse_cpulist(read_line(sysfs + "/node/node" + std::to_string(node) + "/cpulist"))) {
+         cpu_node[cpu] = node;
+      }
+   }
+
+   std::sort(cpus.begin(), cpus.end());
+   for (int cpu : cpus) {
+      if (!online.empty() && !std::binary_search(online.begin(), online.end(), cpu)) {
+         continue;
+      }
+      const std::string dir = sysfs + "/cpu/cpu" + std::to_string(cpu) + "/topology/";
+      Cpu c;
+      c.id = cpu;
+      c.core = read_int(dir + "core_id", cpu);
+      c.package = read_int(dir + "physical_package_id", 0);
+      c.node = cpu_node.count(cpu) ? cpu_node[cpu] : 0;
+      c.thread = 0;
+      cpu_list.push_back(c);
+   }
+
+   // number SMT siblings within every physical core in cpu id order
+   std::map<std::pair<int, int>, int> siblings;
+   for (auto &c : cpu_list) {
+      c.thread = siblings[std::make_pair(c.package, c.core)]++;
+      if (std::find(node_ids.begin(), node_ids.end(), c.node) == node_ids.end()) {
+         node_ids.push_back(c.node);
+      }
+   }
+   std::sort(node_ids.begin(), node_ids.end());
+}
+
+/*
+ *
+ */
+std::vector<int> Topology::node_cpus(int node) const
+{
+   std::vector<int> cpus;
+
+   for (auto &c : cpu_list) {
+      if (c.node == node) {
+         cpus.push_back(c.id);
+      }
+   }
+
+   return cpus;
+}
+
+/*
+ *
+ */
+int Topology::node_of(int cpu) const
+{
+   for (auto &c : cpu_list) {
+      if (c.id == cpu) {
+         return c.node;
+      }
+   }
+
+   return -1;
+}
+
+/*
+ * Spread orders CPUs by SMT level, then by core rank within its node and finally by node,
+ * so consecutive workers land on different nodes. Pack orders CPUs by node first, so
+ * the workers fill all cores of a node, then their siblings, before using the next node.
+ */
+std::vector<int> Topology::placement(Placement policy) const
+{
+   std::map<std::tuple<int, int, int>, int> core_rank;
+   std::map<int, int> node_cores;
+   std::vector<std::tuple<int, int, int, int>> order;
+   std::vector<int> cpus;
+
+   // rank physical cores within their node
+   for (auto &c : cpu_list) {
+      auto key = std::make_tuple(c.node, c.package, c.core);
+      if (!core_rank.count(key)) {
+         core_rank[key] = node_cores[c.node]++;
+      }
+   }
+
+   for (auto &c : cpu_list) {
+      int rank = core_rank[std::make_tuple(c.node, c.package, c.core)];
+      if (policy == Placement::Spread) {
+         order.emplace_back(c.thread, rank, c.node, c.id);
+      } else {
+         order.emplace_back(c.node, c.thread, rank, c.id);
+      }
+   }
+   std::sort(order.begin(), order.end());
+
+   for (auto &o : order) {
+      cpus.push_back(std::get<3>(o));
+   }
+
+   return cpus;
+}
@@ -0,0 +1,633 @@
+/* -*- coding: UTF-8 -*-
+ *
+ *  Copyright (c) 2020 by Inteos Sp. z o.o.
+ *  All rights reserved. See LICENSE file for details.
+ */
+
+/*
+ * File:   bench.cpp
+ *
+ * ThreadPool benchmark suite. Every scenario is run for all selected scheduling modes and
+ * thread counts and the results are reported as text, CSV or JSON.
+ *
+ * Usage: bench [--scenario name[,name...]] [--mode name[,name...]] [--wait name[,name...]]
+ *              [--threads n[,n...]] [--jobs n] [--format text|csv|json] [--output file]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Parallel.h"
+#include "ThreadPool.h"
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Benchmark parameters
+ */
+struct Config {
+   std::vector<std::string> scenarios { "empty", "latency", "fanout", "recursive", "forkjoin", "mixed", "producers",
+                                        "accumulate", "reduce", "futures", "scan", "partition" };
+   std::vector<std::string> modes { "global" };
+   std::vector<std::string> waits { "park" };
+   std::vector<std::size_t> threads {};
+   std::size_t jobs { 200000 };
+   std::string format { "text" };
+   std::string output {};
+};
+
+/*
+ * Single benchmark result, latencies in microseconds
+ */
+struct Result {
+   std::string scenario;
+   std::string mode;
+   std::string wait;
+   std::size_t threads;
+   std::size_t producers;
+   std::size_t ops;
+   double seconds;
+   std::vector<double> latency;     // sorted samples, empty when not measured
+};
+
+static const std::vector<std::pair<std::string, ThreadPool::Scheduling>> mode_names {
+   { "global", ThreadPool::Scheduling::Global },
+   { "steal", ThreadPool::Scheduling::WorkStealing },
+   { "lockfree", ThreadPool::Scheduling::LockFree },
+   { "numa", ThreadPool::Scheduling::Numa },
+   { "deadline", ThreadPool::Scheduling::Deadline },
+};
+
+static const std::vector<std::pair<std::string, ThreadPool::WaitPolicy>> wait_names {
+   { "park", ThreadPool::WaitPolicy::Park },
+   { "spin", ThreadPool::WaitPolicy::Spin },
+   { "adaptive", ThreadPool::WaitPolicy::Adaptive },
+};
+
+static std::vector<std::string> split(const std::string & s)
+{
+   std::vector<std::string> items;
+   std::stringstream ss(s);
+   std::string item;
+
+   while (std::getline(ss, item, ',')) {
+      if (!item.empty()) {
+         items.push_back(item);
+      }
+   }
+
+   return items;
+}
+
+static double elapsed(Clock::time_point start)
+{
+   return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double micros(Clock::duration d)
+{
+   return std::chrono::duration<double, std::micro>(d).count();
+}
+
+static double percentile(const std::vector<double> & sorted, double p)
+{
+   if (sorted.empty()) {
+      return 0.0;
+   }
+   return sorted[static_cast<std::size_t>(p * (sorted.size() - 1))];
+}
+
+// busy waits for the job counter, so the wait itself does not depend on the pool
+static void wait_for(const std::atomic_size_t & done, std::size_t n)
+{
+   while (done.load(std::memory_order_acquire) < n) {
+      std::this_thread::yield();
+   }
+}
+
+// keeps the cpu busy for the given time
+static void spin_for(std::chrono::microseconds us)
+{
+   auto end = Clock::now() + us;
+   while (Clock::now() < end) {}
+}
+
+/*
+ * Throughput of empty jobs posted by a single producer
+ */
+static Result bench_empty(ThreadPool & pool, const Config & cfg)
+{
+   std::atomic_size_t done { 0 };
+   auto start = Clock::now();
+
+   for (std::size_t i = 0; i < cfg.jobs; i++) {
+      pool.post([&done]{ done.fetch_add(1, std::memory_order_release); });
+   }
+   wait_for(done, cfg.jobs);
+
+   return Result { "empty", "", "", pool.size(), 1, cfg.jobs, elapsed(start), {} };
+}
+
+/*
+ * Submit-to-start latency of single jobs submitted in small bursts separated by idle gaps
+ */
+static Result bench_latency(ThreadPool & pool, const Config & cfg)
+{
+   const std::size_t samples = std::max<std::size_t>(1000, cfg.jobs / 20);
+   std::vector<double> lat(samples);
+   auto start = Clock::now();
+
+   for (std::size_t i = 0; i < samples; i++) {
+      auto submitted = Clock::now();
+      pool.submit([&lat, i, submitted]{ lat[i] = micros(Clock::now() - submitted); }).get();
+      if (i % 8 == 7) {
+         std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+   }
+
+   double seconds = elapsed(start);
+   std::sort(lat.begin(), lat.end());
+   return Result { "latency", "", "", pool.size(), 1, samples, seconds, lat };
+}
+
+/*
+ * Rounds of bulk fan-out joined with the aggregate future, latency of a whole round
+ */
+static Result bench_fanout(ThreadPool & pool, const Config & cfg)
+{
+   const std::size_t width = 64;
+   const std::size_t rounds = std::max<std::size_t>(1, cfg.jobs / width);
+   std::vector<std::function<void()>> jobs(width, []{});
+   std::vector<double> lat;
+   auto start = Clock::now();
+
+   lat.reserve(rounds);
+   for (std::size_t r = 0; r < rounds; r++) {
+      auto round = Clock::now();
+      pool.submit_bulk_all(jobs.begin(), jobs.end()).get();
+      lat.push_back(micros(Clock::now() - round));
+   }
+
+   double seconds = elapsed(start);
+   std::sort(lat.begin(), lat.end());
+   return Result { "fanout", "", "", pool.size(), 1, rounds * width, seconds, lat };
+}
+
+// binary tree of jobs spawned from inside the pool
+static void spawn(ThreadPool & pool, std::atomic_size_t & done, unsigned depth)
+{
+   if (depth > 0) {
+      pool.post(spawn, std::ref(pool), std::ref(done), depth - 1);
+      pool.post(spawn, std::ref(pool), std::ref(done), depth - 1);
+   }
+   done.fetch_add(1, std::memory_order_release);
+}
+
+/*
+ * Recursive spawn of a binary job tree
+ */
+static Result bench_recursive(ThreadPool & pool, const Config & cfg)
+{
+   std::atomic_size_t done { 0 };
+   unsigned depth = 1;
+   while ((std::size_t(2) << depth) - 1 < cfg.jobs) {
+      depth++;
+   }
+   const std::size_t jobs = (std::size_t(2) << depth) - 1;
+   auto start = Clock::now();
+
+   pool.post(spawn, std::ref(pool), std::ref(done), depth);
+   wait_for(done, jobs);
+
+   return Result { "recursive", "", "", pool.size(), 1, jobs, elapsed(start), {} };
+}
+
+// binary tree of jobs waiting for their subtrees, returns the number of jobs
+static std::size_t fork_join(ThreadPool & pool, unsigned depth)
+{
+   if (depth == 0) {
+      return 1;
+   }
+   auto left = pool.submit(fork_join, std::ref(pool), depth - 1);
+   std::size_t right = fork_join(pool, depth - 1);
+   pool.wait(left);
+   return left.get() + right + 1;
+}
+
+/*
+ * Recursive divide and conquer, every job waits for its child while helping the pool
+ */
+static Result bench_forkjoin(ThreadPool & pool, const Config & cfg)
+{
+   unsigned depth = 1;
+   while ((std::size_t(2) << depth) - 1 < cfg.jobs) {
+      depth++;
+   }
+   auto start = Clock::now();
+
+   std::size_t jobs = pool.submit(fork_join, std::ref(pool), depth).get();
+
+   return Result { "forkjoin", "", "", pool.size(), 1, jobs, elapsed(start), {} };
+}
+
+/*
+ * Short jobs mixed with 1% of long ones, latency of the short jobs from submit to finish
+ */
+static Result bench_mixed(ThreadPool & pool, const Config & cfg)
+{
+   const std::size_t jobs = std::max<std::size_t>(1000, cfg.jobs / 10);
+   std::vector<double> lat(jobs);
+   std::atomic_size_t done { 0 };
+   auto start = Clock::now();
+
+   for (std::size_t i = 0; i < jobs; i++) {
+      auto submitted = Clock::now();
+      if (i % 100 == 0) {
+         pool.post([&done, &lat, i, submitted]{
+            spin_for(std::chrono::microseconds(500));
+            lat[i] = -1.0;
+            done.fetch_add(1, std::memory_order_release);
+         });
+      } else {
+         pool.post([&done, &lat, i, submitted]{
+            lat[i] = micros(Clock::now() - submitted);
+            done.fetch_add(1, std::memory_order_release);
+         });
+      }
+   }
+   wait_for(done, jobs);
+
+   double seconds = elapsed(start);
+   lat.erase(std::remove(lat.begin(), lat.end(), -1.0), lat.end());
+   std::sort(lat.begin(), lat.end());
+   return Result { "mixed", "", "", pool.size(), 1, jobs, seconds, lat };
+}
+
+/*
+ * Throughput of empty jobs posted concurrently by a number of producer threads
+ */
+static Result bench_producers(ThreadPool & pool, const Config & cfg, std::size_t producers)
+{
+   std::atomic_size_t done { 0 };
+   std::vector<std::thread> threads;
+   const std::size_t per_producer = cfg.jobs / producers;
+   auto start = Clock::now();
+
+   for (std::size_t p = 0; p < producers; p++) {
+      threads.emplace_back([&pool, &done, per_producer]{
+         for (std::size_t i = 0; i < per_producer; i++) {
+            pool.post([&done]{ done.fetch_add(1, std::memory_order_release); });
+         }
+      });
+   }
+   for (auto &t : threads) {
+      t.join();
+   }
+   wait_for(done, per_producer * producers);
+
+   return Result { "producers", "", "", pool.size(), producers, per_producer * producers, elapsed(start), {} };
+}
+
+// array summed by the reduction scenarios, ops are summed elements
+static const std::vector<std::uint64_t> & reduce_data(const Config & cfg)
+{
+   static std::vector<std::uint64_t> data;
+
+   if (data.size() != cfg.jobs * 20) {
+      data.resize(cfg.jobs * 20);
+      std::iota(data.begin(), data.end(), 0);
+   }
+   return data;
+}
+
+static Result reduce_result(const char * name, ThreadPool & pool, std::size_t ops, double seconds,
+                            std::uint64_t sum, std::uint64_t expected)
+{
+   if (sum != expected) {
+      std::cerr << name << ": wrong sum " << sum << ", expected " << expected << std::endl;
+      std::exit(1);
+   }
+   return Result { name, "", "", pool.size(), 1, ops, seconds, {} };
+}
+
+static const std::size_t reduce_rounds = 10;
+
+/*
+ * Serial std::accumulate on the calling thread, the baseline of the reductions
+ */
+static Result bench_accumulate(ThreadPool & pool, const Config & cfg)
+{
+   auto &data = reduce_data(cfg);
+   std::uint64_t sum = 0;
+   auto start = Clock::now();
+
+   for (std::size_t r = 0; r < reduce_rounds; r++) {
+      sum += std::accumulate(data.begin(), data.end(), std::uint64_t(0));
+   }
+
+   const std::uint64_t n = data.size();
+   return reduce_result("accumulate", pool, n * reduce_rounds, elapsed(start), sum, reduce_rounds * (n * (n - 1) / 2));
+}
+
+/*
+ * parallel_reduce with per-participant partial sums
+ */
+static Result bench_reduce(ThreadPool & pool, const Config & cfg)
+{
+   auto &data = reduce_data(cfg);
+   std::uint64_t sum = 0;
+   auto start = Clock::now();
+
+   for (std::size_t r = 0; r < reduce_rounds; r++) {
+      sum += parallel_reduce(pool, data.begin(), data.end(), std::uint64_t(0), std::plus<std::uint64_t>());
+   }
+
+   const std::uint64_t n = data.size();
+   return reduce_result("reduce", pool, n * reduce_rounds, elapsed(start), sum, reduce_rounds * (n * (n - 1) / 2));
+}
+
+/*
+ * A future per chunk reduced serially by the caller, the usual hand written approach
+ */
+static Result bench_futures(ThreadPool & pool, const Config & cfg)
+{
+   auto &data = reduce_data(cfg);
+   const std::size_t chunks = pool.size();
+   const std::size_t chunk = (data.size() + chunks - 1) / chunks;
+   std::vector<Future<std::uint64_t>> futures;
+   std::uint64_t sum = 0;
+   auto start = Clock::now();
+
+   for (std::size_t r = 0; r < reduce_rounds; r++) {
+      futures.clear();
+      for (std::size_t from = 0; from < data.size(); from += chunk) {
+         auto first = data.begin() + from;
+         auto last = data.begin() + std::min(data.size(), from + chunk);
+         futures.push_back(pool.submit([first, last]{ return std::accumulate(first, last, std::uint64_t(0)); }));
+      }
+      for (auto &f : futures) {
+         sum += f.get();
+      }
+   }
+
+   const std::uint64_t n = data.size();
+   return reduce_result("futures", pool, n * reduce_rounds, elapsed(start), sum, reduce_rounds * (n * (n - 1) / 2));
+}
+
+/*
+ * Inclusive prefix sums of the array
+ */
+static Result bench_scan(ThreadPool & pool, const Config & cfg)
+{
+   auto &data = reduce_data(cfg);
+   std::vector<std::uint64_t> out(data.size());
+   std::uint64_t sum = 0;
+   auto start = Clock::now();
+
+   for (std::size_t r = 0; r < reduce_rounds; r++) {
+      parallel_inclusive_scan(pool, data.begin(), data.end(), out.begin());
+      sum += out.back();
+   }
+
+   const std::uint64_t n = data.size();
+   return reduce_result("scan", pool, n * reduce_rounds, elapsed(start), sum, reduce_rounds * (n * (n - 1) / 2));
+}
+
+/*
+ * Stable partition of the array by the lowest bit, the copy of the input is not timed
+ */
+static Result bench_partition(ThreadPool & pool, const Config & cfg)
+{
+   auto &data = reduce_data(cfg);
+   std::vector<std::uint64_t> work(data.size());
+   Clock::duration spent {};
+   std::uint64_t matched = 0;
+
+   for (std::size_t r = 0; r < reduce_rounds; r++) {
+      std::copy(data.begin(), data.end(), work.begin());
+      auto start = Clock::now();
+      auto point = parallel_partition(pool, work.begin(), work.end(), [](std::uint64_t x){ return (x & 1) == 0; });
+      spent += Clock::now() - start;
+      matched += point - work.begin();
+   }
+
+   const std::uint64_t n = data.size();
+   return reduce_result("partition", pool, n * reduce_rounds, std::chrono::duration<double>(spent).count(), matched, reduce_rounds * ((n + 1) / 2));
+}
+
+/*
+ * Report writers
+ */
+static void write_text(std::ostream & out, const std::vector<Result> & results)
+{
+   out << std::left << std::setw(12) << "scenario" << std::setw(9) << "mode" << std::setw(9) << "wait" << std::right
+       << std::setw(8) << "threads" << std::setw(10) << "producers" << std::setw(14) << "ops/s"
+       << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p99.9 us" << std::endl;
+
+   for (auto &r : results) {
+      out << std::left << std::setw(12) << r.scenario << std::setw(9) << r.mode << std::setw(9) << r.wait << std::right
+          << std::setw(8) << r.threads << std::setw(10) << r.producers
+          << std::setw(14) << std::fixed << std::setprecision(0) << r.ops / r.seconds
+          << std::setprecision(2);
+      if (r.latency.empty()) {
+         out << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+      } else {
+         out << std::setw(10) << percentile(r.latency, 0.5) << std::setw(10) << percentile(r.latency, 0.99)
+             << std::setw(10) << percentile(r.latency, 0.999);
+      }
+      out << std::endl;
+   }
+}
+
+static void write_csv(std::ostream & out, const std::vector<Result> & results)
+{
+   out << "scenario,mode,wait,threads,producers,ops,seconds,ops_per_sec,p50_us,p90_us,p99_us,p999_us,max_us" << std::endl;
+
+   for (auto &r : results) {
+      out << r.scenario << "," << r.mode << "," << r.wait << "," << r.threads << "," << r.producers << "," << r.ops << ","
+          << r.seconds << "," << r.ops / r.seconds;
+      for (double p : { 0.5, 0.9, 0.99, 0.999, 1.0 }) {
+         out << ",";
+         if (!r.latency.empty()) {
+            out << percentile(r.latency, p);
+         }
+      }
+      out << std::endl;
+   }
+}
+
+static void write_json(std::ostream & out, const std::vector<Result> & results)
+{
+   out << "[" << std::endl;
+
+   for (std::size_t i = 0; i < results.size(); i++) {
+      auto &r = results[i];
+      out << "  { \"scenario\": \"" << r.scenario << "\", \"mode\": \"" << r.mode << "\", \"wait\": \"" << r.wait << "\", \"threads\": " << r.threads
+          << ", \"producers\": " << r.producers << ", \"ops\": " << r.ops << ", \"seconds\": " << r.seconds
+          << ", \"ops_per_sec\": " << r.ops / r.seconds;
+      if (!r.latency.empty()) {
+         out << ", \"latency_us\": { \"p50\": " << percentile(r.latency, 0.5) << ", \"p90\": " << percentile(r.latency, 0.9)
+             << ", \"p99\": " << percentile(r.latency, 0.99) << ", \"p999\": " << percentile(r.latency, 0.999)
+             << ", \"max\": " << percentile(r.latency, 1.0) << " }";
+      }
+      out << " }" << (i + 1 < results.size() ? "," : "") << std::endl;
+   }
+
+   out << "]" << std::endl;
+}
+
+static void usage()
+{
+   std::cerr << "Usage: bench [--scenario name[,name...]] [--mode name[,name...]] [--wait name[,name...]]" << std::endl
+             << "             [--threads n[,n...]] [--jobs n] [--format text|csv|json] [--output file]" << std::endl
+             << "Scenarios: empty latency fanout recursive forkjoin mixed producers accumulate reduce futures scan partition" << std::endl
+             << "Modes:     global steal lockfree numa deadline all" << std::endl
+             << "Waits:     park spin adaptive all" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+   Config cfg;
+   std::vector<Result> results;
+
+   for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) {
+         usage();
+         return 1;
+      }
+      std::string value = argv[++i];
+      if (arg == "--scenario") {
+         cfg.scenarios = split(value);
+      } else if (arg == "--mode") {
+         auto names = split(value);
+         cfg.modes.clear();
+         for (auto &m : mode_names) {
+            if (value == "all" || std::find(names.begin(), names.end(), m.first) != names.end()) {
+               cfg.modes.push_back(m.first);
+            }
+         }
+      } else if (arg == "--wait") {
+         auto names = split(value);
+         cfg.waits.clear();
+         for (auto &w : wait_names) {
+            if (value == "all" || std::find(names.begin(), names.end(), w.first) != names.end()) {
+               cfg.waits.push_back(w.first);
+            }
+         }
+      } else if (arg == "--threads") {
+         for (auto &t : split(value)) {
+            cfg.threads.push_back(std::strtoul(t.c_str(), nullptr, 10));
+         }
+      } else if (arg == "--jobs") {
+         cfg.jobs = std::max(1UL, std::strtoul(value.c_str(), nullptr, 10));
+      } else if (arg == "--format") {
+         cfg.format = value;
+      } else if (arg == "--output") {
+         cfg.output = value;
+      } else {
+         usage();
+         return 1;
+      }
+   }
+
+   // sweep powers of two up to the number of cpus by default
+   if (cfg.threads.empty()) {
+      const std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+      for (std::size_t t = 1; t < hw; t *= 2) {
+         cfg.threads.push_back(t);
+      }
+      cfg.threads.push_back(hw);
+   }
+
+   for (auto &mode : mode_names) {
+      if (std::find(cfg.modes.begin(), cfg.modes.end(), mode.first) == cfg.modes.end()) {
+         continue;
+      }
+      for (auto &wait : wait_names) {
+         if (std::find(cfg.waits.begin(), cfg.waits.end(), wait.first) == cfg.waits.end()) {
+            continue;
+         }
+         for (auto threads : cfg.threads) {
+            for (auto &scenario : cfg.scenarios) {
+               std::vector<std::size_t> producers { 1 };
+               if (scenario == "producers") {
+                  producers.clear();
+                  for (std::size_t p = 1; p < threads * 2; p *= 2) {
+                     producers.push_back(p);
+                  }
+                  producers.push_back(threads * 2);
+               }
+
+               for (auto p : producers) {
+                  ThreadPool pool(threads, mode.second);
+                  pool.set_wait_policy(wait.second);
+                  pool.init();
+
+                  Result r;
+                  if (scenario == "empty") {
+                     r = bench_empty(pool, cfg);
+                  } else if (scenario == "latency") {
+                     r = bench_latency(pool, cfg);
+                  } else if (scenario == "fanout") {
+                     r = bench_fanout(pool, cfg);
+                  } else if (scenario == "recursive") {
+                     r = bench_recursive(pool, cfg);
+                  } else if (scenario == "forkjoin") {
+                     r = bench_forkjoin(pool, cfg);
+                  } else if (scenario == "mixed") {
+                     r = bench_mixed(pool, cfg);
+                  } else if (scenario == "producers") {
+                     r = bench_producers(pool, cfg, p);
+                  } else if (scenario == "accumulate") {
+                     r = bench_accumulate(pool, cfg);
+                  } else if (scenario == "reduce") {
+                     r = bench_reduce(pool, cfg);
+                  } else if (scenario == "futures") {
+                     r = bench_futures(pool, cfg);
+                  } else if (scenario == "scan") {
+                     r = bench_scan(pool, cfg);
+                  } else if (scenario == "partition") {
+                     r = bench_partition(pool, cfg);
+                  } else {
+                     std::cerr << "Unknown scenario: " << scenario << std::endl;
+                     return 1;
+                  }
+                  r.mode = mode.first;
+                  r.wait = wait.first;
+                  results.push_back(std::move(r));
+                  std::cerr << "." << std::flush;
+               }
+            }
+         }
+      }
+   }
+   std::cerr << std::endl;
+
+   std::ofstream file;
+   if (!cfg.output.empty()) {
+      file.open(cfg.output);
+   }
+   std::ostream & out = cfg.output.empty() ? std::cout : file;
+
+   if (cfg.format == "csv") {
+      write_csv(out, results);
+   } else if (cfg.format == "json") {
+      write_json(out, results);
+   } else {
+      write_text(out, results);
+   }
+
+   return 0;
+}
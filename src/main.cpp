@@ -3,6 +3,7 @@
 #include <ctime>
 #include <ratio>
 #include <chrono>
+#include <string>
 #include "ThreadPool.h"
 
 std::random_device rd;
@@ -41,9 +42,18 @@ void display(ThreadPool * poolptr)
    }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-   ThreadPool pool(4);
+   ThreadPool::Scheduling mode = ThreadPool::Scheduling::Global;
+
+   if (argc > 1 && std::string(argv[1]) == "steal"){
+      mode = ThreadPool::Scheduling::WorkStealing;
+   }
+   if (argc > 1 && std::string(argv[1]) == "lockfree"){
+      mode = ThreadPool::Scheduling::LockFree;
+   }
+
+   ThreadPool pool(4, mode);
    ThreadPool *poolptr = &pool;
    const auto jobs = 100;
    const auto jobs2 = 10000000;
@@ -54,9 +64,7 @@ int main()
       pool.submit(test_thread1);
    }
 
-   while (pool.queue_size() > 0){
-      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-   }
+   pool.wait_idle();
 
    if (counter != jobs){
       std::cout << "Error! counter=" << counter << std::endl;
@@ -81,7 +89,7 @@ int main()
 
    std::chrono::high_resolution_clock::time_point t3 = std::chrono::high_resolution_clock::now();
 
-   while (pool.queue_size() > 0){}
+   pool.wait_idle();
 
    std::chrono::high_resolution_clock::time_point t4 = std::chrono::high_resolution_clock::now();
 
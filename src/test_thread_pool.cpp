@@ -14,9 +14,18 @@
  *
  */
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <numeric>
 #include <random>
+#include <string>
 #include <utility>
+#include <sys/stat.h>
+#include "Coroutine.h"
+#include "Parallel.h"
+#include "TaskGraph.h"
 #include "ThreadPool.h"
 #include "catch.hpp"
 
@@ -71,9 +80,7 @@ int test_thread_p3rr(uint64_t & out, const int a, const int b)
 
 void wait_for_pool_to_complete(ThreadPool &pool)
 {
-   do {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-   } while (pool.queue_size() > 0 || pool.num_running() > 0);
+   pool.wait_idle();
 }
 
 const auto test_vector1 = {1, 2, 3, 4, 6, 8, 16, 128, 256, 1024, 65536};
@@ -146,6 +153,8 @@ TEST_CASE ("Job execution single param", "jobexecsingle")
       auto res = future.get();
       CHECK ( res == v );
       CHECK ( pool.num_available() > 0 );
+      // the future is ready before the worker leaves the job
+      wait_for_pool_to_complete(pool);
       CHECK_FALSE ( pool.num_running() > 0 );
    }
 };
@@ -163,6 +172,8 @@ TEST_CASE ("Job execution double param", "jobexecdouble")
       auto res = future.get();
       CHECK ( res == (a * b) );
       CHECK ( pool.num_available() > 0 );
+      // the future is ready before the worker leaves the job
+      wait_for_pool_to_complete(pool);
       CHECK_FALSE ( pool.num_running() > 0 );
    }
 };
@@ -183,6 +194,8 @@ TEST_CASE ("Job execution triple param", "jobexectriple")
       CHECK ( res == b );
       CHECK ( out == (a * b) );
       CHECK ( pool.num_available() > 0 );
+      // the future is ready before the worker leaves the job
+      wait_for_pool_to_complete(pool);
       CHECK_FALSE ( pool.num_running() > 0 );
    }
 };
@@ -209,3 +222,1292 @@ TEST_CASE ("Init after shutdown", "shutinit")
    pool.shutdown();
    CHECK_FALSE ( pool.num_available() > 0 );
 }
+
+// testing thread, spawns nested jobs into the same pool
+void test_thread_spawn(ThreadPool &pool, const int depth)
+{
+   counter++;
+   if (depth > 0){
+      pool.submit(test_thread_spawn, std::ref(pool), depth - 1);
+      pool.submit(test_thread_spawn, std::ref(pool), depth - 1);
+   }
+}
+
+TEST_CASE ("Work stealing job execution", "stealexec")
+{
+   ThreadPool pool(4, ThreadPool::Scheduling::WorkStealing);
+   pool.init();
+   CHECK ( pool.mode() == ThreadPool::Scheduling::WorkStealing );
+
+   for (auto v : test_vector2){
+      counter = 0;
+      for (auto n = 0; n < v; n++){
+         pool.submit(test_thread_void);
+      }
+      wait_for_pool_to_complete(pool);
+      CHECK ( counter == v );
+      CHECK ( pool.num_available() > 0 );
+      CHECK_FALSE ( pool.num_running() > 0 );
+   }
+
+   for (auto p : test_vector3){
+      auto a = std::get<0>(p);
+      auto b = std::get<1>(p);
+      auto future = pool.submit(test_thread_p2r, a, b);
+      CHECK ( future.get() == (a * b) );
+   }
+};
+
+TEST_CASE ("Work stealing nested submit", "stealnested")
+{
+   ThreadPool pool(4, ThreadPool::Scheduling::WorkStealing);
+   pool.init();
+
+   counter = 0;
+   pool.submit(test_thread_spawn, std::ref(pool), 12);
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == (1 << 13) - 1 );
+};
+
+TEST_CASE ("Nested submit in all modes", "nested")
+{
+   for (auto mode : { ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing, ThreadPool::Scheduling::LockFree,
+                      ThreadPool::Scheduling::Numa, ThreadPool::Scheduling::Deadline }){
+      ThreadPool pool(4, mode);
+      pool.init();
+
+      counter = 0;
+      pool.submit(test_thread_spawn, std::ref(pool), 10);
+      wait_for_pool_to_complete(pool);
+      CHECK ( counter == (1 << 11) - 1 );
+   }
+};
+
+TEST_CASE ("Wait for idle pool", "waitidle")
+{
+   ThreadPool pool(2);
+
+   counter = 0;
+   for (auto n = 0; n < 100; n++){
+      pool.post(test_thread_void);
+   }
+   CHECK ( pool.num_outstanding() == 100 );
+   CHECK_FALSE ( pool.wait_idle(std::chrono::milliseconds(10)) );
+
+   pool.init();
+   CHECK ( pool.wait_idle(std::chrono::seconds(10)) );
+   CHECK ( counter == 100 );
+   CHECK ( pool.num_outstanding() == 0 );
+   CHECK ( pool.queue_size() == 0 );
+   CHECK_FALSE ( pool.num_running() > 0 );
+
+   // nothing outstanding, returns immediately
+   pool.wait_idle();
+   CHECK ( pool.wait_idle(std::chrono::milliseconds(0)) );
+
+   // idle workers looking for work are not counted as running
+   for (auto round = 0; round < 200; round++){
+      pool.post([]{ counter++; });
+      pool.wait_idle();
+      CHECK_FALSE ( pool.num_running() > 0 );
+   }
+};
+
+TEST_CASE ("Work stealing init after shutdown", "stealshutinit")
+{
+   ThreadPool pool(2, ThreadPool::Scheduling::WorkStealing);
+
+   pool.submit(test_thread_void);
+   CHECK ( pool.queue_size() == 1 );
+
+   pool.shutdown();
+   CHECK ( pool.queue_size() == 1 );
+
+   pool.init();
+   wait_for_pool_to_complete(pool);
+   CHECK ( pool.queue_size() == 0 );
+
+   pool.shutdown();
+   CHECK_FALSE ( pool.num_available() > 0 );
+};
+
+TEST_CASE ("Lock-free queue", "lfqueue")
+{
+   LockFreeQueue<int> queue(5);
+   int v;
+
+   CHECK ( queue.capacity() == 8 );
+   CHECK ( queue.empty() );
+   CHECK_FALSE ( queue.dequeue(v) );
+
+   for (auto n = 0; n < 8; n++){
+      CHECK ( queue.try_enqueue(n) );
+   }
+   CHECK ( queue.size() == 8 );
+   CHECK_FALSE ( queue.try_enqueue(8) );
+
+   for (auto n = 0; n < 8; n++){
+      REQUIRE ( queue.dequeue(v) );
+      CHECK ( v == n );
+   }
+   CHECK ( queue.empty() );
+};
+
+TEST_CASE ("Lock-free job execution", "lfexec")
+{
+   ThreadPool pool(4, ThreadPool::Scheduling::LockFree);
+
+   // overflow the ring before the pool is running
+   counter = 0;
+   const int jobs = ThreadPool::ring_capacity + 100;
+   for (auto n = 0; n < jobs; n++){
+      pool.submit(test_thread_none);
+   }
+   CHECK ( pool.queue_size() == jobs );
+
+   pool.init();
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == jobs );
+
+   for (auto p : test_vector3){
+      auto a = std::get<0>(p);
+      auto b = std::get<1>(p);
+      auto future = pool.submit(test_thread_p2r, a, b);
+      CHECK ( future.get() == (a * b) );
+   }
+};
+
+// testing thread, throws an exception
+int test_thread_throw(const int a)
+{
+   throw std::runtime_error(std::to_string(a));
+}
+
+TEST_CASE ("Task storage", "task")
+{
+   int value = 0;
+   std::unique_ptr<int> ptr(new int(5));
+
+   SECTION ("inline"){
+      Task task([&value, p = std::move(ptr)]{ value = *p; });
+      REQUIRE ( static_cast<bool>(task) );
+      Task moved(std::move(task));
+      CHECK_FALSE ( static_cast<bool>(task) );
+      moved();
+      CHECK ( value == 5 );
+   }
+
+   SECTION ("heap"){
+      char big[Task::inline_size * 2] = { 1 };
+      Task task([&value, big]{ value = big[0]; });
+      Task moved;
+      moved = std::move(task);
+      moved();
+      CHECK ( value == 1 );
+      moved.reset();
+      CHECK_FALSE ( static_cast<bool>(moved) );
+   }
+};
+
+TEST_CASE ("Future exceptions", "futexc")
+{
+   SECTION ("exception"){
+      ThreadPool pool(2);
+      pool.init();
+
+      auto future = pool.submit(test_thread_throw, 7);
+      CHECK_THROWS_WITH ( future.get(), "7" );
+      CHECK_FALSE ( future.valid() );
+   }
+
+   SECTION ("broken promise"){
+      Future<int> future;
+      {
+         ThreadPool pool(2);
+         future = pool.submit(test_thread_p1r, 1);
+         CHECK ( future.wait_for(std::chrono::milliseconds(1)) == std::future_status::timeout );
+      }
+      CHECK ( future.is_ready() );
+      CHECK_THROWS_AS ( future.get(), std::future_error );
+   }
+};
+
+TEST_CASE ("Post job execution", "post")
+{
+   for (auto mode : {ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing, ThreadPool::Scheduling::LockFree}){
+      ThreadPool pool(4, mode);
+      std::atomic<int> errors { 0 };
+      pool.set_exception_handler([&errors](std::exception_ptr e){
+         try {
+            std::rethrow_exception(e);
+         } catch (const std::runtime_error &) {
+            errors++;
+         }
+      });
+      pool.init();
+
+      counter = 0;
+      for (auto v : test_vector2){
+         pool.post(test_thread_none);
+         pool.post(test_thread_throw, v);
+      }
+      wait_for_pool_to_complete(pool);
+      CHECK ( counter == test_vector2.size() );
+      CHECK ( errors == test_vector2.size() );
+   }
+};
+
+TEST_CASE ("Bulk submit", "bulk")
+{
+   for (auto mode : {ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing, ThreadPool::Scheduling::LockFree}){
+      ThreadPool pool(4, mode);
+      pool.init();
+
+      std::vector<std::function<int()>> jobs;
+      for (auto v : test_vector2){
+         jobs.push_back([v]{ return test_thread_p1r(v); });
+      }
+
+      auto futures = pool.submit_bulk(jobs.begin(), jobs.end());
+      REQUIRE ( futures.size() == jobs.size() );
+      auto it = test_vector2.begin();
+      for (auto &f : futures){
+         CHECK ( f.get() == *it++ );
+      }
+
+      counter = 0;
+      std::vector<void (*)()> voids(100, test_thread_none);
+      pool.post_bulk(voids.begin(), voids.end());
+      auto all = pool.submit_bulk_all(voids.begin(), voids.end());
+      all.get();
+      wait_for_pool_to_complete(pool);
+      CHECK ( counter == 200 );
+
+      std::vector<std::function<void()>> failing { test_thread_none, []{ test_thread_throw(3); } };
+      auto failed = pool.submit_bulk_all(failing.begin(), failing.end());
+      CHECK_THROWS_WITH ( failed.get(), "3" );
+
+      auto empty = pool.submit_bulk_all(voids.end(), voids.end());
+      CHECK ( empty.is_ready() );
+   }
+};
+
+TEST_CASE ("Lock-free queue bulk", "lfbulk")
+{
+   LockFreeQueue<int> queue(8);
+   std::vector<int> values { 0, 1, 2, 3, 4, 5 };
+   int v;
+
+   CHECK ( queue.try_enqueue_bulk(values.begin(), values.size()) == 6 );
+   CHECK ( queue.try_enqueue_bulk(values.begin(), values.size()) == 2 );
+   CHECK ( queue.try_enqueue_bulk(values.begin(), values.size()) == 0 );
+   for (auto n = 0; n < 8; n++){
+      REQUIRE ( queue.dequeue(v) );
+      CHECK ( v == n % 6 );
+   }
+};
+
+TEST_CASE ("Wait policies", "waitpolicy")
+{
+   for (auto policy : {ThreadPool::WaitPolicy::Park, ThreadPool::WaitPolicy::Spin, ThreadPool::WaitPolicy::Adaptive}){
+      ThreadPool pool(4);
+      pool.set_wait_policy(policy, 64);
+      pool.init();
+
+      for (auto v : test_vector2){
+         counter = 0;
+         for (auto n = 0; n < v; n++){
+            pool.submit(test_thread_void);
+         }
+         wait_for_pool_to_complete(pool);
+         CHECK ( counter == v );
+      }
+
+      // bursts separated by idle periods
+      for (auto v : test_vector1){
+         auto future = pool.submit(test_thread_p1r, v);
+         CHECK ( future.get() == v );
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+   }
+};
+
+// writes a file of the fake sysfs tree creating its parent directories
+void write_sysfs(const std::string & root, const std::string & path, const std::string & value)
+{
+   for (auto pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1)){
+      mkdir((root + "/" + path.substr(0, pos)).c_str(), 0755);
+   }
+   std::ofstream(root + "/" + path) << value << std::endl;
+}
+
+// two nodes with two cores of two SMT threads each, siblings are cpu N and N + 4
+std::string make_fake_sysfs()
+{
+   char tmpl[] = "/tmp/sysfsXXXXXX";
+   std::string root = mkdtemp(tmpl);
+
+   write_sysfs(root, "cpu/online", "0-7");
+   write_sysfs(root, "node/online", "0-1");
+   write_sysfs(root, "node/node0/cpulist", "0-1,4-5");
+   write_sysfs(root, "node/node1/cpulist", "2-3,6-7");
+   for (auto cpu = 0; cpu < 8; cpu++){
+      auto dir = "cpu/cpu" + std::to_string(cpu) + "/topology/";
+      write_sysfs(root, dir + "core_id", std::to_string(cpu % 2));
+      write_sysfs(root, dir + "physical_package_id", std::to_string((cpu / 2) % 2));
+   }
+
+   return root;
+}
+
+TEST_CASE ("CPU topology", "topology")
+{
+   const auto root = make_fake_sysfs();
+
+   SECTION ("parse"){
+      CHECK ( Topology::parse_cpulist("0-2,5,7-8") == std::vector<int>({0, 1, 2, 5, 7, 8}) );
+      CHECK ( Topology::parse_cpulist("").empty() );
+   }
+
+   SECTION ("layout"){
+      Topology topology(root, {0, 1, 2, 3, 4, 5, 6, 7});
+      REQUIRE ( topology.cpus().size() == 8 );
+      CHECK ( topology.nodes() == std::vector<int>({0, 1}) );
+      CHECK ( topology.node_cpus(1) == std::vector<int>({2, 3, 6, 7}) );
+      CHECK ( topology.node_of(5) == 0 );
+      CHECK ( topology.cpus()[4].thread == 1 );
+      CHECK ( topology.placement(Topology::Placement::Spread) == std::vector<int>({0, 2, 1, 3, 4, 6, 5, 7}) );
+      CHECK ( topology.placement(Topology::Placement::Pack) == std::vector<int>({0, 1, 4, 5, 2, 3, 6, 7}) );
+   }
+
+   SECTION ("cpuset"){
+      Topology topology(root, {1, 4, 5, 7, 12});
+      CHECK ( topology.cpus().size() == 4 );
+      CHECK ( topology.placement(Topology::Placement::Spread) == std::vector<int>({1, 7, 4, 5}) );
+      CHECK ( topology.placement(Topology::Placement::Pack) == std::vector<int>({1, 4, 5, 7}) );
+   }
+};
+
+TEST_CASE ("Topology affinity", "affinity")
+{
+   Topology topology;
+
+   for (auto affinity : {ThreadPool::Affinity::Spread, ThreadPool::Affinity::Pack}){
+      ThreadPool pool(4);
+      pool.init(affinity);
+
+      auto map = pool.affinity_map();
+      REQUIRE ( map.size() == 4 );
+      for (auto cpu : map){
+         CHECK ( topology.node_of(cpu) >= 0 );
+      }
+
+      auto future = pool.submit(test_thread_p1r, 1);
+      CHECK ( future.get() == 1 );
+   }
+};
+
+TEST_CASE ("NUMA job execution", "numa")
+{
+   ThreadPool pool(4, ThreadPool::Scheduling::Numa);
+   REQUIRE ( pool.num_nodes() >= 1 );
+
+   counter = 0;
+   for (std::size_t node = 0; node <= pool.num_nodes(); node++){
+      pool.submit_on_node(node, test_thread_none);
+   }
+   CHECK ( pool.queue_size() == pool.num_nodes() + 1 );
+
+   pool.init();
+#if defined __linux__
+   // workers are pinned to their nodes when the topology is known
+   if (!Topology().nodes().empty()){
+      for (auto cpu : pool.affinity_map()){
+         CHECK ( cpu >= 0 );
+      }
+   }
+#endif
+   for (auto v : test_vector2){
+      pool.post(test_thread_none);
+      auto future = pool.submit_on_node(v, test_thread_p1r, v);
+      CHECK ( future.get() == v );
+   }
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == pool.num_nodes() + 1 + test_vector2.size() );
+};
+
+TEST_CASE ("Node allocator", "nodealloc")
+{
+   LockFreeQueue<int, NodeAllocator<int>> queue(1024, NodeAllocator<int>(0));
+   int v;
+
+   for (auto n = 0; n < 1024; n++){
+      CHECK ( queue.try_enqueue(n) );
+   }
+   for (auto n = 0; n < 1024; n++){
+      REQUIRE ( queue.dequeue(v) );
+      CHECK ( v == n );
+   }
+
+   NodeAllocator<int> heap;
+   int * p = heap.allocate(16);
+   p[15] = 1;
+   heap.deallocate(p, 16);
+};
+
+// waits up to 5 seconds for the pool to reach the number of available workers
+bool wait_for_available(ThreadPool &pool, const std::size_t n)
+{
+   for (auto i = 0; i < 500 && pool.num_available() != n; i++){
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+   }
+   return pool.num_available() == n;
+}
+
+TEST_CASE ("Resize pool", "resize")
+{
+   ThreadPool pool(4);
+   pool.init();
+   CHECK ( wait_for_available(pool, 4) );
+
+   pool.resize(2);
+   CHECK ( pool.size() == 2 );
+   CHECK ( wait_for_available(pool, 2) );
+
+   counter = 0;
+   for (auto n = 0; n < 100; n++){
+      pool.post(test_thread_none);
+   }
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == 100 );
+
+   // bounded by the maximum size
+   pool.resize(8);
+   CHECK ( pool.size() == 4 );
+   CHECK ( wait_for_available(pool, 4) );
+
+   pool.shutdown();
+   CHECK_FALSE ( pool.num_available() > 0 );
+};
+
+TEST_CASE ("Elastic pool", "elastic")
+{
+   ThreadPool pool(2, ThreadPool::Scheduling::WorkStealing);
+   pool.set_limits(1, 4, std::chrono::milliseconds(50));
+   pool.set_growth(4, std::chrono::milliseconds(5));
+   CHECK ( pool.min_size() == 1 );
+   CHECK ( pool.max_size() == 4 );
+   pool.init();
+   CHECK ( pool.size() == 2 );
+
+   // backlog grows the pool up to the maximum
+   counter = 0;
+   for (auto n = 0; n < 200; n++){
+      pool.post(test_thread_void);
+   }
+   CHECK ( wait_for_available(pool, 4) );
+   CHECK ( pool.size() == 4 );
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == 200 );
+
+   // idle workers retire down to the minimum
+   CHECK ( wait_for_available(pool, 1) );
+   CHECK ( pool.size() == 1 );
+
+   counter = 0;
+   pool.submit(test_thread_spawn, std::ref(pool), 8);
+   wait_for_pool_to_complete(pool);
+   CHECK ( counter == (1 << 9) - 1 );
+};
+
+TEST_CASE ("Priority levels", "priority")
+{
+   std::vector<int> order;
+   auto record = [&order](const int v){ order.push_back(v); };
+
+   SECTION ("strict"){
+      ThreadPool pool(1);
+
+      for (auto n = 0; n < 4; n++){
+         pool.post(ThreadPool::Priority::Low, record, 3);
+         pool.post(record, 2);
+         pool.post(ThreadPool::Priority::High, record, 1);
+      }
+      CHECK ( pool.queue_size(ThreadPool::Priority::High) == 4 );
+      CHECK ( pool.queue_size(ThreadPool::Priority::Normal) == 4 );
+      CHECK ( pool.queue_size(ThreadPool::Priority::Low) == 4 );
+      CHECK ( pool.queue_size() == 12 );
+
+      pool.init();
+      wait_for_pool_to_complete(pool);
+      CHECK ( order == std::vector<int>({1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3}) );
+   }
+
+   SECTION ("aging"){
+      ThreadPool pool(1, ThreadPool::Scheduling::LockFree);
+      pool.set_priority_aging(2);
+
+      for (auto n = 0; n < 2; n++){
+         pool.post(ThreadPool::Priority::Low, record, 3);
+      }
+      for (auto n = 0; n < 6; n++){
+         pool.post(ThreadPool::Priority::High, record, 1);
+      }
+
+      pool.init();
+      wait_for_pool_to_complete(pool);
+      CHECK ( order == std::vector<int>({1, 1, 3, 1, 1, 3, 1, 1}) );
+   }
+
+   SECTION ("futures"){
+      ThreadPool pool(2, ThreadPool::Scheduling::WorkStealing);
+      pool.init();
+
+      for (auto v : test_vector2){
+         auto high = pool.submit(ThreadPool::Priority::High, test_thread_p1r, v);
+         auto low = pool.submit(ThreadPool::Priority::Low, test_thread_p2r, v, 2);
+         CHECK ( high.get() == v );
+         CHECK ( low.get() == v * 2 );
+      }
+   }
+};
+
+TEST_CASE ("Deadline queue", "deadlinequeue")
+{
+   DeadlineQueue<int> queue(4);
+   const auto now = std::chrono::steady_clock::now();
+   std::chrono::steady_clock::time_point deadline;
+   int v;
+
+   CHECK ( queue.empty() );
+   for (auto n = 0; n < 16; n++){
+      queue.push(n, now + std::chrono::milliseconds(16 - n), n);
+   }
+   queue.push(3, now + std::chrono::milliseconds(1), 100);
+   CHECK ( queue.size() == 17 );
+
+   // equal deadlines leave the shard in FIFO order
+   REQUIRE ( queue.pop(v, deadline) );
+   CHECK ( v == 15 );
+   REQUIRE ( queue.pop(v, deadline) );
+   CHECK ( v == 100 );
+   CHECK ( deadline == now + std::chrono::milliseconds(1) );
+   for (auto n = 14; n >= 0; n--){
+      REQUIRE ( queue.pop(v, deadline) );
+      CHECK ( v == n );
+   }
+   CHECK_FALSE ( queue.pop(v, deadline) );
+   CHECK ( queue.empty() );
+};
+
+TEST_CASE ("Deadline scheduling", "deadline")
+{
+   const auto now = std::chrono::steady_clock::now();
+
+   SECTION ("earliest first"){
+      ThreadPool pool(1, ThreadPool::Scheduling::Deadline);
+      std::vector<int> order;
+      auto record = [&order](const int v){ order.push_back(v); };
+
+      pool.post(record, 0);
+      for (auto n = 1; n <= 8; n++){
+         pool.post(now + std::chrono::seconds(60 - n), record, n);
+      }
+      CHECK ( pool.queue_size() == 9 );
+
+      pool.init();
+      wait_for_pool_to_complete(pool);
+      CHECK ( order == std::vector<int>({8, 7, 6, 5, 4, 3, 2, 1, 0}) );
+      CHECK ( pool.deadlines_met() == 8 );
+      CHECK ( pool.deadlines_missed() == 0 );
+   }
+
+   SECTION ("drop expired"){
+      ThreadPool pool(1, ThreadPool::Scheduling::Deadline);
+      pool.set_drop_expired(true);
+
+      auto late = pool.submit(now - std::chrono::seconds(1), test_thread_p1r, 1);
+      auto fresh = pool.submit(now + std::chrono::seconds(60), test_thread_p1r, 2);
+      pool.init();
+
+      CHECK ( fresh.get() == 2 );
+      late.wait();
+      CHECK ( late.is_cancelled() );
+      CHECK_THROWS_AS ( late.get(), TaskCancelled );
+      wait_for_pool_to_complete(pool);
+      CHECK ( pool.deadlines_met() == 1 );
+      CHECK ( pool.deadlines_missed() == 1 );
+      CHECK ( pool.deadlines_dropped() == 1 );
+   }
+
+   SECTION ("other modes"){
+      ThreadPool pool(2);
+      pool.init();
+
+      auto future = pool.submit(now - std::chrono::seconds(1), test_thread_p1r, 3);
+      CHECK ( future.get() == 3 );
+      CHECK ( pool.deadlines_missed() == 0 );
+   }
+};
+
+TEST_CASE ("Timer wheel", "timerwheel")
+{
+   const auto start = std::chrono::steady_clock::now();
+   TimerWheel wheel(std::chrono::milliseconds(1), start);
+   std::vector<TimerWheel::Id> ids;
+   std::vector<Task> expired;
+   std::vector<int> fired;
+
+   // delays on all levels of the wheel
+   const std::vector<int> delays = { 1, 255, 256, 257, 1000, 65535, 65536, 70000, 16777216, 20000000 };
+   for (auto d : delays){
+      ids.push_back(wheel.add(start + std::chrono::milliseconds(d), Task([&fired, d]{ fired.push_back(d); })));
+   }
+   auto cancelled = wheel.add(start + std::chrono::milliseconds(500), Task([&fired]{ fired.push_back(-1); }));
+   CHECK ( wheel.size() == delays.size() + 1 );
+   CHECK ( wheel.cancel(cancelled) );
+   CHECK_FALSE ( wheel.cancel(cancelled) );
+   CHECK_FALSE ( wheel.cancel(TimerWheel::invalid) );
+
+   for (auto d : delays){
+      // nothing fires before its time
+      wheel.advance(start + std::chrono::milliseconds(d - 1), expired);
+      CHECK ( expired.empty() );
+      wheel.advance(start + std::chrono::milliseconds(d), expired);
+      REQUIRE ( expired.size() == 1 );
+      expired.front()();
+      expired.clear();
+      CHECK ( fired.back() == d );
+   }
+   CHECK ( wheel.size() == 0 );
+   CHECK ( wheel.next_expiry() == std::chrono::steady_clock::time_point::max() );
+   CHECK_FALSE ( wheel.cancel(ids.front()) );
+
+   // periodic timer fires every period until cancelled
+   int calls = 0;
+   auto now = start + std::chrono::milliseconds(20000000);
+   auto periodic = wheel.add(now + std::chrono::milliseconds(10), std::chrono::milliseconds(10),
+                             std::make_shared<std::function<void()>>([&calls]{ calls++; }));
+   wheel.advance(now + std::chrono::milliseconds(35), expired);
+   CHECK ( expired.size() == 3 );
+   CHECK ( wheel.next_expiry() == now + std::chrono::milliseconds(40) );
+   CHECK ( wheel.cancel(periodic) );
+   for (auto &t : expired){
+      t();
+   }
+   CHECK ( calls == 3 );
+
+   // many pending timers
+   for (auto n = 0; n < 200000; n++){
+      ids.push_back(wheel.add(now + std::chrono::milliseconds(n % 5000), Task([]{})));
+   }
+   CHECK ( wheel.size() == 200000 );
+   std::size_t ok = 0;
+   for (auto n = 0; n < 100000; n++){
+      ok += wheel.cancel(ids[ids.size() - 1 - n]) ? 1 : 0;
+   }
+   CHECK ( ok == 100000 );
+   expired.clear();
+   wheel.advance(now + std::chrono::milliseconds(5000), expired);
+   CHECK ( expired.size() == 100000 );
+   CHECK ( wheel.size() == 0 );
+};
+
+TEST_CASE ("Timer wheel after idle time", "timeridle")
+{
+   // the wheel has not been advanced for an hour
+   const auto now = std::chrono::steady_clock::now();
+   TimerWheel wheel(std::chrono::milliseconds(1), now - std::chrono::hours(1));
+   std::vector<Task> expired;
+
+   const auto when = now + std::chrono::milliseconds(5);
+   wheel.add(when, Task([]{}));
+   CHECK ( wheel.next_expiry() >= when );
+   CHECK ( wheel.next_expiry() <= when + std::chrono::milliseconds(1) );
+
+   wheel.advance(when - std::chrono::milliseconds(1), expired);
+   CHECK ( expired.empty() );
+   wheel.advance(when, expired);
+   CHECK ( expired.size() == 1 );
+   CHECK ( wheel.size() == 0 );
+};
+
+TEST_CASE ("Delayed and periodic jobs", "timers")
+{
+   ThreadPool pool(2);
+   pool.init();
+
+   const auto start = std::chrono::steady_clock::now();
+   auto future = pool.submit_after(std::chrono::milliseconds(20), test_thread_p1r, 7);
+   CHECK ( future.get() == 7 );
+   CHECK ( std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20) );
+
+   counter = 0;
+   auto id = pool.post_after(std::chrono::seconds(60), test_thread_none);
+   CHECK ( pool.num_timers() == 1 );
+   CHECK ( pool.cancel_timer(id) );
+   CHECK ( pool.num_timers() == 0 );
+
+   auto periodic = pool.submit_every(std::chrono::milliseconds(5), test_thread_none);
+   for (auto i = 0; i < 500 && counter < 3; i++){
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+   }
+   CHECK ( counter >= 3 );
+   CHECK ( pool.cancel_timer(periodic) );
+   CHECK_FALSE ( pool.cancel_timer(periodic) );
+   wait_for_pool_to_complete(pool);
+   const int calls = counter;
+   std::this_thread::sleep_for(std::chrono::milliseconds(20));
+   CHECK ( counter == calls );
+};
+
+TEST_CASE ("Continuations", "continuations")
+{
+   // a single worker would deadlock if a stage blocked it waiting for the previous one
+   ThreadPool pool(1);
+   pool.init();
+
+   auto chained = pool.submit(test_thread_p1r, 20)
+      .then([](Future<int> f){ return f.get() + 1; })
+      .then([](Future<int> f){ return std::to_string(f.get()); });
+   CHECK ( chained.get() == "21" );
+
+   // continuation attached to a completed future
+   auto done = pool.submit(test_thread_p1r, 5);
+   done.wait();
+   auto next = done.then([](Future<int> f){ return f.get() * 2; });
+   CHECK_FALSE ( done.valid() );
+   CHECK ( next.get() == 10 );
+
+   // exceptions reach the continuation
+   auto failed = pool.submit([]() -> int { throw std::runtime_error("stage"); })
+      .then([](Future<int> f){
+         try {
+            f.get();
+         } catch (const std::runtime_error &) {
+            return true;
+         }
+         return false;
+      });
+   CHECK ( failed.get() );
+
+   SECTION ("when_all") {
+      std::vector<Future<int>> futures;
+      for (auto i = 0; i < 10; i++){
+         futures.push_back(pool.submit(test_thread_p1r, i));
+      }
+      auto all = when_all(futures.begin(), futures.end())
+         .then([](Future<std::vector<Future<int>>> f){
+            int sum = 0;
+            for (auto &r : f.get()){
+               sum += r.get();
+            }
+            return sum;
+         });
+      CHECK ( all.get() == 45 );
+
+      std::vector<Future<int>> empty;
+      CHECK ( when_all(empty.begin(), empty.end()).get().empty() );
+   }
+
+   SECTION ("when_any") {
+      std::vector<Future<int>> futures;
+      futures.push_back(pool.submit_after(std::chrono::seconds(60), test_thread_p1r, 0));
+      futures.push_back(pool.submit(test_thread_p1r, 1));
+      auto any = when_any(futures.begin(), futures.end());
+      auto result = any.get();
+      CHECK ( result.index == 1 );
+      CHECK ( result.futures.size() == 2 );
+      CHECK ( result.futures[1].get() == 1 );
+      CHECK_FALSE ( result.futures[0].is_ready() );
+   }
+};
+
+TEST_CASE ("Task graph", "taskgraph")
+{
+   ThreadPool pool(2, ThreadPool::Scheduling::WorkStealing);
+   pool.init();
+
+   // diamond: a -> b, c -> d, with a chain e -> f beside it
+   std::vector<int> log;
+   std::mutex lock;
+   auto step = [&](int id, int ms){
+      return [&, id, ms]{
+         std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+         std::lock_guard<std::mutex> l(lock);
+         log.push_back(id);
+      };
+   };
+   TaskGraph graph;
+   auto a = graph.add(step(0, 5));
+   auto b = graph.add(step(1, 20));
+   auto c = graph.add(step(2, 1));
+   auto d = graph.add(step(3, 5));
+   auto e = graph.add(step(4, 1));
+   auto f = graph.add(step(5, 1));
+   graph.add_edge(a, b);
+   graph.add_edge(a, c);
+   graph.add_edge(b, d);
+   graph.add_edge(c, d);
+   graph.add_edge(e, f);
+
+   // the graph is reusable
+   for (auto run = 0; run < 3; run++){
+      log.clear();
+      graph.run(pool).get();
+      REQUIRE ( log.size() == 6 );
+      auto pos = [&](int id){ return std::find(log.begin(), log.end(), id) - log.begin(); };
+      CHECK ( pos(0) < pos(1) );
+      CHECK ( pos(0) < pos(2) );
+      CHECK ( pos(1) < pos(3) );
+      CHECK ( pos(2) < pos(3) );
+      CHECK ( pos(4) < pos(5) );
+      CHECK ( graph.start_time(d) >= graph.start_time(b) + graph.elapsed(b) );
+      CHECK ( graph.elapsed(b) >= std::chrono::milliseconds(20) );
+      // a -> b -> d is the longest path
+      CHECK ( graph.critical_path() >= std::chrono::milliseconds(30) );
+      CHECK ( graph.critical_path() == graph.elapsed(a) + graph.elapsed(b) + graph.elapsed(d) );
+   }
+
+   SECTION ("failure") {
+      TaskGraph failing;
+      counter = 0;
+      auto first = failing.add([]{ throw std::runtime_error("node"); });
+      auto second = failing.add(test_thread_none);
+      failing.add_edge(first, second);
+      CHECK_THROWS_AS ( failing.run(pool).get(), std::runtime_error );
+      CHECK ( counter == 0 );
+   }
+
+   SECTION ("cycle") {
+      TaskGraph cyclic;
+      auto x = cyclic.add([]{});
+      auto y = cyclic.add([]{});
+      cyclic.add_edge(x, y);
+      cyclic.add_edge(y, x);
+      CHECK_THROWS_AS ( cyclic.run(pool), std::logic_error );
+      CHECK ( TaskGraph().run(pool).is_ready() );
+   }
+
+   SECTION ("dropped") {
+      // jobs dropped by a pool destroyed before init still complete the run
+      Future<void> result;
+      {
+         ThreadPool idle(1);
+         result = graph.run(idle);
+      }
+      REQUIRE ( result.is_ready() );
+      CHECK_THROWS_AS ( result.get(), std::future_error );
+   }
+};
+
+TEST_CASE ("Parallel for", "parallelfor")
+{
+   ThreadPool pool(3);
+   pool.init();
+
+   const auto schedule = GENERATE(Schedule::Static, Schedule::Dynamic, Schedule::Guided, Schedule::Auto);
+   const int n = 100000;
+   std::vector<std::atomic_int> hits(n);
+   for (auto &h : hits){
+      h = 0;
+   }
+
+   parallel_for(pool, 0, n, [&hits](int i){ hits[i]++; }, schedule);
+   CHECK ( std::all_of(hits.begin(), hits.end(), [](const std::atomic_int & h){ return h == 1; }) );
+
+   // offset and small ranges, explicit grain
+   std::atomic_long sum { 0 };
+   parallel_for(pool, -50L, 50L, [&sum](long i){ sum += i + 50; }, schedule, 7);
+   CHECK ( sum == 4950 );
+   parallel_for(pool, 5, 5, [](int){ FAIL ( "empty range" ); }, schedule);
+   parallel_for(pool, 5, 6, [&sum](int i){ sum += i; }, schedule);
+   CHECK ( sum == 4955 );
+
+   // skewed work and nested loops from a job of a busy pool
+   std::atomic_int inner { 0 };
+   std::vector<Future<void>> futures;
+   for (auto j = 0; j < 4; j++){
+      futures.push_back(pool.submit([&]{
+         parallel_for(pool, 0, 64, [&](int i){
+            if (i % 16 == 0){
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            inner++;
+         }, schedule);
+      }));
+   }
+   for (auto &f : futures){
+      f.get();
+   }
+   CHECK ( inner == 256 );
+
+   CHECK_THROWS_AS ( parallel_for(pool, 0, 1000, [](int i){
+      if (i == 500){
+         throw std::runtime_error("body");
+      }
+   }, schedule), std::runtime_error );
+};
+
+TEST_CASE ("Parallel reduce", "parallelreduce")
+{
+   ThreadPool pool(3);
+   pool.init();
+
+   const auto schedule = GENERATE(Schedule::Static, Schedule::Dynamic, Schedule::Guided, Schedule::Auto);
+   std::vector<long> data(100001);
+   std::iota(data.begin(), data.end(), 0L);
+
+   CHECK ( parallel_reduce(pool, data.begin(), data.end(), 0L, std::plus<long>(), schedule) == 5000050000L );
+   CHECK ( parallel_reduce(pool, data.begin(), data.begin(), 1L, std::multiplies<long>(), schedule) == 1L );
+   CHECK ( parallel_transform_reduce(pool, data.begin(), data.begin() + 1000, 0L, std::plus<long>(),
+                                     [](long x){ return x * x; }, schedule) == 332833500L );
+
+   // histogram with partial results which are not trivially copyable
+   auto histogram = parallel_transform_reduce(pool, data.begin(), data.end(), std::vector<int>(10),
+      [](std::vector<int> a, std::vector<int> b){
+         for (std::size_t i = 0; i < a.size(); i++){
+            a[i] += b[i];
+         }
+         return a;
+      },
+      [](long x){
+         std::vector<int> h(10);
+         h[x % 10]++;
+         return h;
+      }, schedule, 1000);
+   CHECK ( histogram[0] == 10001 );
+   CHECK ( std::accumulate(histogram.begin(), histogram.end(), 0) == 100001 );
+};
+
+TEST_CASE ("Parallel sort", "parallelsort")
+{
+   ThreadPool pool(3, ThreadPool::Scheduling::WorkStealing);
+   pool.init();
+
+   std::mt19937 gen(42);
+
+   // radix path for integral keys, including negative ones
+   std::vector<int> ints(300000);
+   for (auto &i : ints){
+      i = static_cast<int>(gen());
+   }
+   auto expected = ints;
+   std::sort(expected.begin(), expected.end());
+   parallel_sort(pool, ints.begin(), ints.end());
+   CHECK ( ints == expected );
+
+   // merge sort with a comparator
+   std::vector<std::string> words(100000);
+   for (auto &w : words){
+      w = std::to_string(gen() % 50000);
+   }
+   auto sorted = words;
+   std::sort(sorted.begin(), sorted.end(), std::greater<std::string>());
+   parallel_sort(pool, words.begin(), words.end(), std::greater<std::string>());
+   CHECK ( words == sorted );
+
+   // stable sorts keep the order of equal keys
+   std::vector<std::pair<int, int>> records(200000);
+   for (std::size_t i = 0; i < records.size(); i++){
+      records[i] = std::make_pair(static_cast<int>(gen() % 1000) - 500, static_cast<int>(i));
+   }
+   auto stable = records;
+   std::stable_sort(stable.begin(), stable.end(), [](const std::pair<int, int> & a, const std::pair<int, int> & b){ return a.first < b.first; });
+   auto radix = records;
+   parallel_stable_sort(pool, records.begin(), records.end(), [](const std::pair<int, int> & a, const std::pair<int, int> & b){ return a.first < b.first; });
+   CHECK ( records == stable );
+   parallel_radix_sort(pool, radix.begin(), radix.end(), [](const std::pair<int, int> & r){ return r.first; });
+   CHECK ( radix == stable );
+
+   // short ranges and a nested sort from a job
+   std::vector<unsigned> small { 3, 1, 2 };
+   parallel_sort(pool, small.begin(), small.end());
+   CHECK ( small == std::vector<unsigned> { 1, 2, 3 } );
+   bool flags[] = { true, false, true, false, false };
+   parallel_sort(pool, std::begin(flags), std::end(flags));
+   parallel_stable_sort(pool, std::begin(flags), std::end(flags));
+   CHECK ( std::is_sorted(std::begin(flags), std::end(flags)) );
+   CHECK ( std::count(std::begin(flags), std::end(flags), true) == 2 );
+   std::vector<double> reals(100000);
+   for (auto &r : reals){
+      r = std::generate_canonical<double, 53>(gen);
+   }
+   pool.submit([&]{ parallel_stable_sort(pool, reals.begin(), reals.end()); }).get();
+   CHECK ( std::is_sorted(reals.begin(), reals.end()) );
+};
+
+TEST_CASE ("Parallel scan and partition", "parallelscan")
+{
+   const auto threads = GENERATE(1, 3);
+   ThreadPool pool(threads);
+   pool.init();
+
+   std::vector<long> data(100003);
+   for (std::size_t i = 0; i < data.size(); i++){
+      data[i] = static_cast<long>(i % 7) - 3;
+   }
+
+   std::vector<long> expected(data.size()), out(data.size());
+   std::partial_sum(data.begin(), data.end(), expected.begin());
+   CHECK ( parallel_inclusive_scan(pool, data.begin(), data.end(), out.begin()) == out.end() );
+   CHECK ( out == expected );
+
+   // exclusive scan in place with an operation other than plus
+   std::vector<long> ones(70000, 1);
+   parallel_exclusive_scan(pool, ones.begin(), ones.end(), ones.begin(), 10L);
+   CHECK ( ones.front() == 10 );
+   CHECK ( ones.back() == 10 + 69999 );
+   std::vector<unsigned> bits(50000, 2), maxima(bits.size());
+   bits[40000] = 5;
+   parallel_exclusive_scan(pool, bits.begin(), bits.end(), maxima.begin(), 0u, [](unsigned a, unsigned b){ return std::max(a, b); });
+   CHECK ( maxima[0] == 0 );
+   CHECK ( maxima[40000] == 2 );
+   CHECK ( maxima[40001] == 5 );
+
+   // empty and short ranges
+   CHECK ( parallel_inclusive_scan(pool, data.begin(), data.begin(), out.begin()) == out.begin() );
+   parallel_inclusive_scan(pool, data.begin(), data.begin() + 3, out.begin());
+   CHECK ( out[2] == -6 );
+
+   // stable partition
+   std::vector<std::pair<long, std::size_t>> records(data.size());
+   for (std::size_t i = 0; i < records.size(); i++){
+      records[i] = std::make_pair(data[i], i);
+   }
+   auto stable = records;
+   auto negative = [](const std::pair<long, std::size_t> & r){ return r.first < 0; };
+   auto point = std::stable_partition(stable.begin(), stable.end(), negative);
+   CHECK ( parallel_partition(pool, records.begin(), records.end(), negative) - records.begin() == point - stable.begin() );
+   CHECK ( records == stable );
+};
+
+#ifdef THREADPOOL_COROUTINES
+static CoTask<int> coro_value(ThreadPool & pool, int value)
+{
+   co_await pool.schedule();
+   co_return value;
+}
+
+static CoTask<int> coro_sum(ThreadPool & pool, int n)
+{
+   int sum = 0;
+   for (auto i = 0; i < n; i++){
+      sum += co_await coro_value(pool, i);
+   }
+   co_return sum;
+}
+
+static CoTask<void> coro_throw(ThreadPool & pool)
+{
+   co_await pool.schedule();
+   throw std::runtime_error("coroutine");
+}
+
+static CoTask<std::thread::id> coro_thread(ThreadPool & pool)
+{
+   co_await pool.schedule();
+   co_return std::this_thread::get_id();
+}
+
+TEST_CASE ("Coroutines", "coroutines")
+{
+   ThreadPool pool(2);
+   pool.init();
+
+   CHECK ( sync_wait(coro_value(pool, 42)) == 42 );
+   CHECK ( sync_wait(coro_sum(pool, 100)) == 4950 );
+   CHECK ( sync_wait(coro_thread(pool)) != std::this_thread::get_id() );
+   CHECK_THROWS_AS ( sync_wait(coro_throw(pool)), std::runtime_error );
+
+   // tasks completing inline resume the awaiting coroutine directly
+   auto chain = [](ThreadPool & p) -> CoTask<long> {
+      long sum = 0;
+      for (auto i = 0; i < 100; i++){
+         sum += co_await [](long x) -> CoTask<long> { co_return x; }(i);
+      }
+      co_await p.schedule();
+      co_return sum;
+   };
+   CHECK ( sync_wait(chain(pool)) == 4950L );
+};
+#endif
+
+TEST_CASE ("Fibers", "fibers")
+{
+   if (!FiberScheduler::supported()){
+      return;
+   }
+
+   ThreadPool pool(4);
+   pool.set_fibers();
+   pool.init();
+
+   // blocked jobs suspend their fibers, so the workers keep all of them in flight
+   const int n = 10000;
+   FiberMutex mutex;
+   FiberConditionVariable cv;
+   int arrived = 0;
+   bool open = false;
+   std::atomic_int done { 0 };
+   for (auto i = 0; i < n; i++){
+      pool.submit([&]{
+         std::unique_lock<FiberMutex> lock(mutex);
+         arrived++;
+         cv.notify_all();
+         cv.wait(lock, [&open]{ return open; });
+         done++;
+      });
+   }
+   {
+      // a thread outside of the pool waits on the same primitives
+      std::unique_lock<FiberMutex> lock(mutex);
+      cv.wait(lock, [&]{ return arrived == n; });
+      CHECK ( done == 0 );
+      open = true;
+      cv.notify_all();
+   }
+   pool.wait_idle();
+   CHECK ( done == n );
+
+   // contended mutex with yields inside the critical section
+   long counter = 0;
+   for (auto i = 0; i < 100; i++){
+      pool.submit([&]{
+         for (auto k = 0; k < 100; k++){
+            std::lock_guard<FiberMutex> lock(mutex);
+            long c = counter;
+            if (k % 10 == 0){
+               fiber_yield();
+            }
+            counter = c + 1;
+         }
+      });
+   }
+   pool.wait_idle();
+   CHECK ( counter == 10000 );
+
+   // sleeping fibers do not hold their workers
+   auto start = std::chrono::steady_clock::now();
+   std::vector<Future<int>> sleepers;
+   for (auto i = 0; i < 200; i++){
+      sleepers.push_back(pool.submit([i]{ fiber_sleep_for(std::chrono::milliseconds(20)); return i; }));
+   }
+   for (auto i = 0; i < 200; i++){
+      CHECK ( sleepers[i].get() == i );
+   }
+   CHECK ( std::chrono::steady_clock::now() - start < std::chrono::seconds(2) );
+
+   // exceptions of fiber jobs reach their futures
+   auto f = pool.submit([]{ fiber_yield(); throw std::runtime_error("fiber"); });
+   CHECK_THROWS_AS ( f.get(), std::runtime_error );
+};
+
+TEST_CASE ("Blocking sections", "blocking")
+{
+   const auto mode = GENERATE(ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing);
+   ThreadPool pool(2, mode);
+   pool.set_compensation(4);
+   pool.init();
+   CHECK ( wait_for_available(pool, 2) );
+
+   // both workers block on a job submitted after them, extra workers run it
+   std::promise<void> gate;
+   std::shared_future<void> opened = gate.get_future().share();
+   auto first = pool.submit([&pool, opened]{ auto guard = pool.blocking_section(); opened.wait(); return 1; });
+   auto second = pool.submit([&pool, opened]{ auto guard = pool.blocking_section(); opened.wait(); return 2; });
+   CHECK ( wait_for_available(pool, 3) );
+   pool.post([&gate]{ gate.set_value(); });
+   CHECK ( first.get() + second.get() == 3 );
+
+   // a chain of nested waits deeper than the pool does not deadlock
+   std::function<int(int)> chain = [&pool, &chain](int n) -> int {
+      if (n == 0){
+         return 0;
+      }
+      auto f = pool.submit(chain, n - 1);
+      auto guard = pool.blocking_section();
+      return f.get() + 1;
+   };
+   CHECK ( pool.submit(chain, 5).get() == 5 );
+
+   // the extra workers retire after the sections end
+   CHECK ( wait_for_available(pool, 2) );
+   CHECK ( pool.size() == 2 );
+
+   // no effect outside of the workers
+   {
+      auto guard = pool.blocking_section();
+      CHECK ( pool.num_available() == 2 );
+   }
+};
+
+static long help_fib(ThreadPool & pool, long n)
+{
+   if (n < 2){
+      return n;
+   }
+   auto f = pool.submit(help_fib, std::ref(pool), n - 1);
+   long r = help_fib(pool, n - 2);
+   pool.wait(f);
+   return r + f.get();
+}
+
+TEST_CASE ("Help while waiting", "help")
+{
+   const auto mode = GENERATE(ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing,
+                              ThreadPool::Scheduling::LockFree, ThreadPool::Scheduling::Numa,
+                              ThreadPool::Scheduling::Deadline);
+   ThreadPool pool(2, mode);
+   pool.init();
+
+   // every job waits for its subtask, far more of them than workers
+   auto f = pool.submit(help_fib, std::ref(pool), 18L);
+   pool.wait(f);
+   CHECK ( f.get() == 2584 );
+
+   // a single worker runs the awaited job by itself
+   ThreadPool single(1, mode);
+   single.init();
+   CHECK ( single.submit(help_fib, std::ref(single), 12L).get() == 144 );
+
+   // the awaited job is submitted later by another thread
+   std::atomic_bool go { false };
+   Future<int> late;
+   auto waiter = single.submit([&single, &late, &go]{
+      while (!go){
+         std::this_thread::yield();
+      }
+      single.wait(late);
+      return late.get() + 1;
+   });
+   late = single.submit([]{ return 41; });
+   go = true;
+   CHECK ( waiter.get() == 42 );
+};
+
+// counts the jobs of a binary tree, every job waits for both of its children
+static std::size_t help_fork_join(ThreadPool & pool, unsigned depth)
+{
+   if (depth == 0){
+      return 1;
+   }
+   auto left = pool.submit(help_fork_join, std::ref(pool), depth - 1);
+   auto right = pool.submit(help_fork_join, std::ref(pool), depth - 1);
+   pool.wait(left);
+   pool.wait(right);
+   return left.get() + right.get() + 1;
+}
+
+TEST_CASE ("Fork-join in all modes", "forkjoin")
+{
+   for (auto mode : { ThreadPool::Scheduling::Global, ThreadPool::Scheduling::WorkStealing, ThreadPool::Scheduling::LockFree,
+                      ThreadPool::Scheduling::Numa, ThreadPool::Scheduling::Deadline }){
+      ThreadPool pool(4, mode);
+      pool.init();
+
+      CHECK ( pool.submit(help_fork_join, std::ref(pool), 14U).get() == (1U << 15) - 1 );
+      // the waits did not need extra workers
+      CHECK ( pool.size() == 4 );
+   }
+};